@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include "../src/websocket.hpp"
+#include "../src/websocket_server.h"
+
+// Many coroutine sessions on one thread, each connecting to a local echo server and doing
+// request/response round trips. The echo server runs on a second thread. With a pipeline depth
+// above 1 each session sends that many messages before reading the echoes, which then arrive
+// back to back.
+
+#define NETWORK_BUFFER_LENGTH 1024
+#define DEFAULT_NUM_SESSIONS 2000
+#define DEFAULT_NUM_ROUND_TRIPS 100
+#define DEFAULT_PIPELINE_DEPTH 1
+#define PAYLOAD "{\"temperature\":22.5,\"on\":true}"
+
+static void run_echo_server(ws_server* server, std::size_t num_connections) {
+    std::vector<ws_handle> handles(num_connections);
+    std::vector<char> buffers(num_connections * NETWORK_BUFFER_LENGTH);
+    std::size_t num_accepted = 0;
+    std::size_t num_closed = 0;
+    ws_server_event events[64];
+
+    while (num_closed < num_connections) {
+        int n = ws_server_wait(server, events, 64, -1);
+        for (int i = 0; i < n; ++i) {
+            if (events[i].type == WS_SERVER_EVENT_ACCEPT) {
+                while (num_accepted < num_connections &&
+                       ws_accept(server, &handles[num_accepted], &buffers[num_accepted * NETWORK_BUFFER_LENGTH],
+                                 NETWORK_BUFFER_LENGTH) == 0) {
+                    num_accepted++;
+                }
+                continue;
+            }
+            if (events[i].type == WS_SERVER_EVENT_HANDSHAKE_FAILED) {
+                num_closed++;
+                continue;
+            }
+
+            ws_handle* handle = events[i].handle;
+            ws_received_message_type type;
+            void* payload;
+            struct timeval no_wait = {0, 0};
+            int r;
+            // frames that came in with the same read are only returned by further calls
+            do {
+                r = ws_receive(handle, &type, &payload, &no_wait);
+                if (r >= 0 && type == WS_PAYLOAD_TYPE_TEXT) {
+                    std::memmove(ws_get_outgoing_payload_ptr(handle), payload, (std::size_t) r);
+                    ws_send_text(handle, (std::size_t) r);
+                }
+            } while (r >= 0 && type != WS_PAYLOAD_TYPE_NONE);
+            if (r < 0) {
+                ws_server_close_connection(server, handle);
+                num_closed++;
+            }
+        }
+    }
+}
+
+static ws::task session(ws::event_loop& loop, const std::string& url, std::size_t num_round_trips,
+                        std::size_t pipeline_depth, std::size_t& num_completed) {
+    ws::connection_options options;
+    options.network_buffer_length = NETWORK_BUFFER_LENGTH;
+    ws::connection c = co_await ws::async_connect(loop, url, options);
+
+    for (std::size_t i = 0; i < num_round_trips; i += pipeline_depth) {
+        std::size_t batch = std::min(pipeline_depth, num_round_trips - i);
+        for (std::size_t j = 0; j < batch; ++j) {
+            std::span<char> outgoing = c.outgoing_payload();
+            std::memcpy(outgoing.data(), PAYLOAD, sizeof(PAYLOAD) - 1);
+            co_await c.async_send_text(sizeof(PAYLOAD) - 1);
+        }
+
+        for (std::size_t j = 0; j < batch; ++j) {
+            ws::message m = co_await c.async_receive();
+            if (m.type != ws::message_type::text || m.payload.size() != sizeof(PAYLOAD) - 1 ||
+                std::memcmp(m.payload.data(), PAYLOAD, m.payload.size()) != 0) {
+                throw std::runtime_error("unexpected echo");
+            }
+        }
+    }
+    num_completed++;
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t num_sessions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : DEFAULT_NUM_SESSIONS;
+    std::size_t num_round_trips = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : DEFAULT_NUM_ROUND_TRIPS;
+    std::size_t pipeline_depth = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : DEFAULT_PIPELINE_DEPTH;
+    if (pipeline_depth == 0) {
+        std::printf("\nInvalid pipeline depth\n");
+        return 1;
+    }
+
+    // both ends of every connection live in this process
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    ws_server server;
+    int r = ws_server_init(&server, "127.0.0.1", 0, 4096);
+    if (r < 0) {
+        std::printf("\nError in ws_server_init: %d\n", r);
+        return 1;
+    }
+    std::thread server_thread(run_echo_server, &server, num_sessions);
+
+    std::string url = "ws://127.0.0.1:" + std::to_string(server.port) + "/";
+    std::size_t num_completed = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        ws::event_loop loop;
+        for (std::size_t i = 0; i < num_sessions; ++i) {
+            loop.spawn(session(loop, url, num_round_trips, pipeline_depth, num_completed));
+        }
+        try {
+            loop.run();
+        } catch (const std::exception& e) {
+            std::printf("\nSession failed: %s\n", e.what());
+            std::exit(1);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    server_thread.join();
+    ws_server_close(&server);
+
+    std::printf("%d sessions x %d round trips (pipeline depth %d) on one thread in %.3fs, %.0f round trips/s\n",
+                (int) num_completed, (int) num_round_trips, (int) pipeline_depth, elapsed,
+                (double) (num_completed * num_round_trips) / elapsed);
+    return num_completed == num_sessions ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../src/websocket_client.h"
+#include "../src/websocket_internal.h"
+
+// frames/sec for outgoing frames, mostly small text messages.
+// the rand() rows frame the way _send did before the per-handle mask generator, for comparison.
+// the ws_send_text rows include the send to a loopback udp socket connected to itself,
+// a full receive queue drops the datagrams so the send never blocks.
+
+#define DEFAULT_ITERATIONS 1000000
+#define BUFFER_LENGTH 2048
+
+static volatile long sink;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void report(const char* name, double start_ns, long iterations) {
+    double ns_per_frame = (now_ns() - start_ns) / (double) iterations;
+    printf("%-44s %8.1f ns/op %12.0f frames/s\n", name, ns_per_frame, 1e9 / ns_per_frame);
+}
+
+static int _rand_build_frame(char* payload, const size_t payload_length, char** frame_start) {
+    bool is_long_payload = payload_length > _WS_MAX_PAYLOAD_FOR_SHORT_HEADER ? true : false;
+    int header_length = is_long_payload ?
+                        _WS_FRAME_HEADER_FOR_LONG_PAYLOAD : _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD;
+
+    char* header_pos = payload - header_length;
+    *frame_start = header_pos;
+    *(header_pos) = (char) (_WS_HEADER_FIN_BIT | _WS_HEADER_OPCODE_TEXT);
+    header_pos++;
+    *(header_pos) = (char) _WS_HEADER_MASK_BIT;
+
+    if (is_long_payload) {
+        *(header_pos) |= _WS_PAYLOAD_LENGTH_EXTENDED_16BIT;
+        header_pos++;
+        uint16_t l = htons((uint16_t) payload_length);
+        memcpy(header_pos, &l, sizeof(uint16_t));
+        header_pos += sizeof(uint16_t);
+    }
+    else {
+        *(header_pos) |= payload_length;
+        header_pos++;
+    }
+
+    char* mask = header_pos;
+    size_t i;
+    for (i = 0; i < _WS_HEADER_MASK_SIZE; ++i) {
+        mask[i] = (char) (rand() % 256);
+    }
+    for (i = 0; i < payload_length; ++i) {
+        payload[i] = (char) (payload[i] ^ mask[i % _WS_HEADER_MASK_SIZE]);
+    }
+
+    return header_length + (int) payload_length;
+}
+
+static void bench_rand_frame(const char* name, char* buffer, size_t payload_length, long iterations) {
+    char* payload = buffer + _WS_FRAME_HEADER_FOR_LONG_PAYLOAD;
+    char* frame_start;
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _rand_build_frame(payload, payload_length, &frame_start) + *frame_start;
+    }
+    report(name, start, iterations);
+}
+
+static void bench_build_frame(const char* name, ws_handle* handle, size_t payload_length, long iterations) {
+    char* payload = ws_get_outgoing_payload_ptr(handle);
+    char* frame_start;
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _ws_build_frame(handle, _WS_HEADER_OPCODE_TEXT, payload, payload_length, &frame_start) +
+                *frame_start;
+    }
+    report(name, start, iterations);
+}
+
+static void bench_send_text(const char* name, ws_handle* handle, size_t payload_length, long iterations) {
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += ws_send_text(handle, payload_length);
+    }
+    report(name, start, iterations);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+
+    static char buffer[BUFFER_LENGTH];
+    memset(buffer, 'x', sizeof(buffer));
+
+    ws_handle handle;
+    memset(&handle, 0, sizeof(handle));
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    handle.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (handle.sockfd < 0 ||
+        bind(handle.sockfd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+        getsockname(handle.sockfd, (struct sockaddr*) &address, &address_length) < 0 ||
+        connect(handle.sockfd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        perror("loopback udp socket");
+        return 1;
+    }
+    handle.network_buffer.s = buffer;
+    handle.network_buffer.length = sizeof(buffer);
+    _ws_init_mask_generator(&handle.mask_generator);
+
+    bench_rand_frame("rand() mask, 16 byte text", buffer, 16, iterations);
+    bench_build_frame("client frame, 16 byte text", &handle, 16, iterations);
+    bench_rand_frame("rand() mask, 64 byte text", buffer, 64, iterations);
+    bench_build_frame("client frame, 64 byte text", &handle, 64, iterations);
+    bench_rand_frame("rand() mask, 125 byte text", buffer, 125, iterations);
+    bench_build_frame("client frame, 125 byte text", &handle, 125, iterations);
+    bench_rand_frame("rand() mask, 1000 byte text (16 bit length)", buffer, 1000, iterations);
+    bench_build_frame("client frame, 1000 byte text (16 bit length)", &handle, 1000, iterations);
+
+    handle.is_server = true;
+    bench_build_frame("server frame, 64 byte text", &handle, 64, iterations);
+    bench_build_frame("server frame, 1000 byte text (16 bit length)", &handle, 1000, iterations);
+    handle.is_server = false;
+
+    bench_send_text("ws_send_text to udp loopback, 16 byte text", &handle, 16, iterations);
+    bench_send_text("ws_send_text to udp loopback, 125 byte text", &handle, 125, iterations);
+
+    close(handle.sockfd);
+    return 0;
+}
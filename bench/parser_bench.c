@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/websocket_client.h"
+#include "../src/websocket_internal.h"
+
+// ns/op for the url, handshake and frame header parsers on realistic inputs
+
+#define DEFAULT_ITERATIONS 1000000
+
+#define HANDSHAKE_RESPONSE \
+    "HTTP/1.1 101 Switching Protocols\r\n" \
+    "Server: nginx\r\n" \
+    "Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n" \
+    "Connection: upgrade\r\n" \
+    "Upgrade: websocket\r\n" \
+    "Sec-WebSocket-Accept: HSmrc0sMlYUkAGmm5OPpG2HaGWk=\r\n" \
+    "\r\n"
+
+#define REDIRECT_RESPONSE \
+    "HTTP/1.1 302 Found\r\n" \
+    "Server: nginx\r\n" \
+    "Content-Length: 0\r\n" \
+    "Location: wss://home.sensibo.com/ws/v1/pods?id=abc123\r\n" \
+    "\r\n"
+
+static volatile long sink;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void report(const char* name, double start_ns, long iterations) {
+    printf("%-44s %8.1f ns/op\n", name, (now_ns() - start_ns) / (double) iterations);
+}
+
+static void bench_parse_url(const char* name, const char* url, long iterations) {
+    ws_endpoint endpoint;
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += ws_parse_url(url, &endpoint, false) + endpoint.port;
+    }
+    report(name, start, iterations);
+}
+
+static void bench_status_line(long iterations) {
+    static const char line[] = "HTTP/1.1 101 Switching Protocols";
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _ws_get_http_status_code_from_status_line(line, sizeof(line) - 1);
+    }
+    report("status line", start, iterations);
+}
+
+static void bench_http_header(const char* name, const char* header_name, long iterations) {
+    static char response[] = HANDSHAKE_RESPONSE;
+    char* headers_start = strstr(response, "\r\n") + 2;
+    ws_lstr headers;
+    ws_lstr value;
+    headers.s = headers_start;
+    headers.length = sizeof(response) - 1 - (headers_start - response);
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _ws_get_http_header(headers, header_name, &value);
+    }
+    report(name, start, iterations);
+}
+
+static void bench_handshake_response(const char* name, char* response, size_t length, long iterations) {
+    ws_lstr redirect_url;
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _ws_parse_http_handshake_response(response, length, &redirect_url);
+    }
+    report(name, start, iterations);
+}
+
+static void bench_frame_header(const char* name, const char* frame, size_t length, long iterations) {
+    _ws_frame_header header;
+    long i;
+    double start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+        sink += _ws_parse_frame_header(frame, length, &header) + (long) header.payload_length;
+    }
+    report(name, start, iterations);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+
+    bench_parse_url("ws_parse_url host only", "localhost", iterations);
+    bench_parse_url("ws_parse_url ws://ip:port/path", "ws://192.168.1.10:8080/ws", iterations);
+    bench_parse_url("ws_parse_url wss://host/path?query", "wss://home.sensibo.com/ws/v1/pods?id=abc123", iterations);
+
+    bench_status_line(iterations);
+
+    bench_http_header("http header, first (server)", "server", iterations);
+    bench_http_header("http header, last (sec-websocket-accept)", "sec-websocket-accept", iterations);
+    bench_http_header("http header, missing (location)", "location", iterations);
+
+    static char handshake_response[] = HANDSHAKE_RESPONSE;
+    static char redirect_response[] = REDIRECT_RESPONSE;
+    bench_handshake_response("handshake response 101", handshake_response, sizeof(handshake_response) - 1,
+                             iterations);
+    bench_handshake_response("handshake response 302", redirect_response, sizeof(redirect_response) - 1,
+                             iterations);
+
+    static char frame[70000];
+    memset(frame, 0, sizeof(frame));
+    frame[0] = (char) 0x81;
+    frame[1] = 32;
+    bench_frame_header("frame header, 32 byte text", frame, 2 + 32, iterations);
+    frame[1] = (char) (0x80 | 32);
+    bench_frame_header("frame header, 32 byte masked text", frame, 2 + 4 + 32, iterations);
+    frame[1] = 126;
+    frame[2] = 0x03;
+    frame[3] = (char) 0xE8;
+    bench_frame_header("frame header, 1000 byte text (16 bit length)", frame, 4 + 1000, iterations);
+    frame[1] = 127;
+    memset(frame + 2, 0, 8);
+    frame[7] = 0x01;
+    frame[8] = 0x00;
+    frame[9] = 0x00;
+    bench_frame_header("frame header, 65536 byte text (64 bit length)", frame, 10 + 65536, iterations);
+
+    return 0;
+}
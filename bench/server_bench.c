@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "../src/websocket_client.h"
+#include "../src/websocket_server.h"
+
+// Accept rate and broadcast fan-out throughput over loopback.
+// Clients run on a second thread: they connect with ws_init and then count raw frame bytes.
+
+#define NETWORK_BUFFER_LENGTH 1024
+#define READ_BUFFER_LENGTH (64 * 1024)
+#define DEFAULT_NUM_CONNECTIONS 500
+#define DEFAULT_NUM_MESSAGES 10000
+#define DEFAULT_PAYLOAD_LENGTH 64
+#define SHORT_FRAME_HEADER_LENGTH 2
+#define LONG_FRAME_HEADER_LENGTH 4
+
+typedef struct {
+    ws_endpoint endpoint;
+    size_t num_connections;
+    ws_handle* handles;
+    char* buffers;
+    unsigned long long expected_bytes;
+    int result;
+} client_context;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void* run_clients(void* arg) {
+    client_context* ctx = arg;
+    unsigned long long received = 0;
+    size_t i;
+
+    for (i = 0; i < ctx->num_connections; ++i) {
+        int r = ws_init(&ctx->handles[i], ctx->buffers + i * NETWORK_BUFFER_LENGTH, NETWORK_BUFFER_LENGTH,
+                        ctx->endpoint, NULL, 0);
+        if (r < 0) {
+            printf("\nError in ws_init for client %d: %d\n", (int) i, r);
+            ctx->result = r;
+            return NULL;
+        }
+        // broadcasting may already have started, frames that came with the handshake response count too
+        received += ctx->handles[i].received_length;
+    }
+
+    int epoll_fd = epoll_create1(0);
+    for (i = 0; i < ctx->num_connections; ++i) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = ctx->handles[i].sockfd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctx->handles[i].sockfd, &event);
+    }
+
+    static char read_buffer[READ_BUFFER_LENGTH];
+    struct epoll_event events[64];
+    while (received < ctx->expected_bytes) {
+        int n = epoll_wait(epoll_fd, events, 64, 1000);
+        if (n <= 0) {
+            printf("\nClients stalled after %llu of %llu bytes\n", received, ctx->expected_bytes);
+            ctx->result = -1;
+            break;
+        }
+        int j;
+        for (j = 0; j < n; ++j) {
+            ssize_t r;
+            while ((r = read(events[j].data.fd, read_buffer, READ_BUFFER_LENGTH)) > 0) {
+                received += (unsigned long long) r;
+            }
+        }
+    }
+
+    close(epoll_fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    size_t num_connections = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : DEFAULT_NUM_CONNECTIONS;
+    size_t num_messages = argc > 2 ? (size_t) strtoul(argv[2], NULL, 10) : DEFAULT_NUM_MESSAGES;
+    size_t payload_length = argc > 3 ? (size_t) strtoul(argv[3], NULL, 10) : DEFAULT_PAYLOAD_LENGTH;
+    int r;
+
+    // both ends of every connection live in this process
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    ws_server server;
+    r = ws_server_init(&server, "127.0.0.1", 0, 4096);
+    if (r < 0) {
+        printf("\nError in ws_server_init: %d\n", r);
+        return 1;
+    }
+
+    ws_handle* handles = calloc(num_connections, sizeof(ws_handle));
+    ws_handle** subscribers = calloc(num_connections, sizeof(ws_handle*));
+    char* buffers = malloc(num_connections * NETWORK_BUFFER_LENGTH);
+    char* payload = malloc(payload_length);
+    client_context ctx;
+    ctx.handles = calloc(num_connections, sizeof(ws_handle));
+    ctx.buffers = malloc(num_connections * NETWORK_BUFFER_LENGTH);
+    if (handles == NULL || subscribers == NULL || buffers == NULL || payload == NULL ||
+        ctx.handles == NULL || ctx.buffers == NULL) {
+        printf("\nOut of memory\n");
+        return 1;
+    }
+    memset(payload, 'x', payload_length);
+
+    size_t header_length = payload_length <= 125 ? SHORT_FRAME_HEADER_LENGTH : LONG_FRAME_HEADER_LENGTH;
+    strcpy(ctx.endpoint.hostname, "127.0.0.1");
+    strcpy(ctx.endpoint.path_and_query, "/");
+    ctx.endpoint.port = server.port;
+    ctx.endpoint.is_ssl = false;
+    ctx.num_connections = num_connections;
+    ctx.expected_bytes = (unsigned long long) num_messages * num_connections * (header_length + payload_length);
+    ctx.result = 0;
+
+    double start = now_s();
+    pthread_t client_thread;
+    pthread_create(&client_thread, NULL, run_clients, &ctx);
+
+    size_t num_accepted = 0;
+    size_t num_open = 0;
+    ws_server_event events[64];
+    while (num_open < num_connections) {
+        int n = ws_server_wait(&server, events, 64, 1000);
+        if (n <= 0) {
+            printf("\nAccept stalled after %d connections: %d\n", (int) num_open, n);
+            return 1;
+        }
+        int e;
+        for (e = 0; e < n; ++e) {
+            if (events[e].type == WS_SERVER_EVENT_HANDSHAKE_FAILED) {
+                printf("\nHandshake failed: %d\n", events[e].result);
+                return 1;
+            }
+            if (events[e].type == WS_SERVER_EVENT_OPEN) {
+                num_open++;
+                continue;
+            }
+            if (events[e].type != WS_SERVER_EVENT_ACCEPT) continue;
+            while (num_accepted < num_connections) {
+                r = ws_accept(&server, &handles[num_accepted], buffers + num_accepted * NETWORK_BUFFER_LENGTH,
+                              NETWORK_BUFFER_LENGTH);
+                if (r == WS_ERROR_NO_PENDING_CONNECTION) break;
+                if (r < 0) {
+                    printf("\nError in ws_accept: %d\n", r);
+                    return 1;
+                }
+                subscribers[num_accepted] = &handles[num_accepted];
+                num_accepted++;
+            }
+        }
+    }
+    double accept_elapsed = now_s() - start;
+
+    printf("accepted %d connections in %.3fs, %.0f accepts/s (including the client handshake)\n",
+           (int) num_connections, accept_elapsed, (double) num_connections / accept_elapsed);
+
+    start = now_s();
+    size_t i;
+    for (i = 0; i < num_messages; ++i) {
+        r = ws_broadcast_text(&server, subscribers, num_connections, payload, payload_length, NULL);
+        if (r != 0) {
+            printf("\nError in ws_broadcast_text: %d failed\n", r);
+            return 1;
+        }
+    }
+    pthread_join(client_thread, NULL);
+    double broadcast_elapsed = now_s() - start;
+
+    if (ctx.result < 0) {
+        return 1;
+    }
+
+    double deliveries = (double) num_messages * (double) num_connections;
+    printf("broadcast %d x %d byte messages to %d subscribers in %.3fs, %.0f messages/s, %.0f deliveries/s, %.1f MB/s\n",
+           (int) num_messages, (int) payload_length, (int) num_connections, broadcast_elapsed,
+           (double) num_messages / broadcast_elapsed, deliveries / broadcast_elapsed,
+           (double) ctx.expected_bytes / broadcast_elapsed / 1e6);
+
+    for (i = 0; i < num_connections; ++i) {
+        ws_server_close_connection(&server, &handles[i]);
+        close(ctx.handles[i].sockfd);
+    }
+    ws_server_close(&server);
+    return 0;
+}
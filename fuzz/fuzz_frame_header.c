@@ -0,0 +1,17 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/websocket_internal.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // an exact size copy so reads past the end are caught
+    char* frame = malloc(size);
+    _ws_frame_header header;
+    memcpy(frame, data, size);
+    if (_ws_parse_frame_header(frame, size, &header) == 0 &&
+        header.header_length + header.payload_length > size) {
+        abort(); // the parser has to reject frames that don't fit the buffer
+    }
+    free(frame);
+    return 0;
+}
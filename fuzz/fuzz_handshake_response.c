@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/websocket_internal.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // an exact size copy so reads past the end are caught
+    char* response = malloc(size);
+    ws_lstr redirect_url;
+    memcpy(response, data, size);
+    _ws_parse_http_handshake_response(response, size, &redirect_url);
+    free(response);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/websocket_internal.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // an exact size copy so reads past the end are caught
+    ws_lstr headers;
+    ws_lstr value;
+    headers.s = malloc(size);
+    headers.length = size;
+    memcpy(headers.s, data, size);
+    _ws_get_http_header(headers, "location", &value);
+    _ws_get_http_header(headers, "sec-websocket-accept", &value);
+    free(headers.s);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/websocket_internal.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // an exact size copy so reads past the end are caught
+    char* line = malloc(size);
+    memcpy(line, data, size);
+    _ws_get_http_status_code_from_status_line(line, size);
+    free(line);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/websocket_client.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // ws_parse_url takes a terminated string
+    char* url = malloc(size + 1);
+    ws_endpoint endpoint;
+    memcpy(url, data, size);
+    url[size] = 0;
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (ws_parse_url(url, &endpoint, i == 1) == 0 &&
+            (strnlen(endpoint.hostname, sizeof(endpoint.hostname)) == sizeof(endpoint.hostname) ||
+             strnlen(endpoint.path_and_query, sizeof(endpoint.path_and_query)) == sizeof(endpoint.path_and_query))) {
+            abort(); // parsed fields have to stay terminated
+        }
+    }
+    free(url);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Runs a fuzz target without libFuzzer: on the files given as arguments (e.g. a corpus or a crash
+// reproducer), or on random inputs when there are none. Build with a sanitizer to catch bad accesses.
+
+#define RANDOM_RUNS 200000
+#define RANDOM_MAX_LENGTH 512
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char *argv[]) {
+    static uint8_t buffer[1 << 20];
+    int i;
+
+    if (argc > 1) {
+        for (i = 1; i < argc; ++i) {
+            FILE* f = fopen(argv[i], "rb");
+            if (f == NULL) {
+                printf("\nCannot open %s\n", argv[i]);
+                return 1;
+            }
+            size_t size = fread(buffer, 1, sizeof(buffer), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(buffer, size);
+        }
+        return 0;
+    }
+
+    srand(1);
+    for (i = 0; i < RANDOM_RUNS; ++i) {
+        size_t size = (size_t) (rand() % RANDOM_MAX_LENGTH);
+        size_t j;
+        for (j = 0; j < size; ++j) {
+            // mostly printable, with the characters the parsers look for well represented
+            int r = rand() % 8;
+            buffer[j] = (uint8_t) (r == 0 ? '\r' : r == 1 ? '\n' : r == 2 ? ':' : r == 3 ? ' ' : rand() % 256);
+        }
+        LLVMFuzzerTestOneInput(buffer, size);
+    }
+    printf("%d random inputs ok\n", RANDOM_RUNS);
+    return 0;
+}
@@ -1,11 +1,26 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "src/websocket_client.h"
+#include "src/websocket_internal.h"
+#include "src/ws_capture.h"
+#ifdef __linux__
+#include <arpa/inet.h>
+#include "src/websocket_server.h"
+#endif
 
 #define NETWORK_BUFFER_LENGTH 1024
+#define CAPTURE_CAPACITY (64 * 1024 * 1024)
 static char shared_network_buffer[NETWORK_BUFFER_LENGTH];
 
+#define QUEUE_TEST_FRAMES 200
+#define QUEUE_TEST_PAYLOAD_LENGTH 1000
+#define QUEUE_TEST_QUEUE_LENGTH (16 * 1024)
+#define QUEUE_TEST_STREAM_LENGTH (64 * 1024)
+
 static const char* const EXTRA_HEADERS[] = {
         "X-Sensibo-Whatchamacallit: Foo=Bar,Baz",
         "X-Sensibo-Id: MyID"
@@ -18,6 +33,360 @@ void test_endpoint_parser(char *url, bool allow_relative) {
     printf("%s\tr=%d\tis_ssl=%d hostname=%s port=%d path_and_query=%s\n", url, r, endpoint.is_ssl, endpoint.hostname, endpoint.port, endpoint.path_and_query);
 }
 
+// like test_endpoint_parser, but compares against the expected result
+void check_endpoint_parser(char *url, int expected_r, bool expected_is_ssl, size_t expected_hostname_length) {
+    ws_endpoint endpoint;
+    int r = ws_parse_url(url, &endpoint, false);
+    bool is_ok = r == expected_r &&
+                 (r < 0 || (endpoint.is_ssl == expected_is_ssl && strlen(endpoint.hostname) == expected_hostname_length));
+    printf("%s\t%s\tr=%d\n", is_ok ? "ok" : "FAILED", url, r);
+}
+
+void check_handshake_response_parser(const char *response, int expected_r) {
+    char buffer[256];
+    ws_lstr redirect_url;
+    size_t length = strlen(response);
+    memcpy(buffer, response, length);
+    int r = _ws_parse_http_handshake_response(buffer, length, &redirect_url);
+    printf("%s\thandshake response \"%.20s...\"\tr=%d\n", r == expected_r ? "ok" : "FAILED", response, r);
+}
+
+// a server frame split across two writes and two frames in one write come back whole and in order
+void test_received_frames(void) {
+    static char network_buffer[256];
+    static const char split_frame[] = "\x81\x05" "hello";
+    static const char two_frames[] = "\x81\x03" "abc" "\x89\x02" "hi";
+    int fds[2];
+    int r;
+    bool is_ok = true;
+    ws_received_message_type t;
+    struct timeval timeout;
+    char *payload;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        printf("FAILED\treceived frames\tsocketpair failed\n");
+        return;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    ws_handle ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.sockfd = fds[0];
+    ws.network_buffer.s = network_buffer;
+    ws.network_buffer.length = sizeof(network_buffer);
+    ws.received_offset = _WS_RECEIVE_HEADROOM;
+
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+    write(fds[1], split_frame, 4);
+    r = ws_receive(&ws, &t, (void**) &payload, &timeout);
+    is_ok = is_ok && r == 0 && t == WS_PAYLOAD_TYPE_NONE;
+    write(fds[1], split_frame + 4, sizeof(split_frame) - 1 - 4);
+    r = ws_receive(&ws, &t, (void**) &payload, &timeout);
+    is_ok = is_ok && r == 5 && t == WS_PAYLOAD_TYPE_TEXT && memcmp(payload, "hello", 5) == 0;
+
+    write(fds[1], two_frames, sizeof(two_frames) - 1);
+    r = ws_receive(&ws, &t, (void**) &payload, &timeout);
+    is_ok = is_ok && r == 3 && t == WS_PAYLOAD_TYPE_TEXT && memcmp(payload, "abc", 3) == 0;
+    r = ws_receive(&ws, &t, (void**) &payload, &timeout);
+    is_ok = is_ok && r == 2 && t == WS_PAYLOAD_TYPE_PING && memcmp(payload, "hi", 2) == 0;
+    r = ws_receive(&ws, &t, (void**) &payload, &timeout);
+    is_ok = is_ok && r == 0 && t == WS_PAYLOAD_TYPE_NONE;
+
+    printf("%s\treceived frames\n", is_ok ? "ok" : "FAILED");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// reads every record and checks they are the committed "abc" then "def", in time order
+static bool is_capture_test_content(const ws_capture* capture) {
+    static const char* const expected[] = {"abc", "def"};
+    ws_capture_record record;
+    size_t offset = 0;
+    uint64_t last_timestamp_ns = 0;
+    int num_records = 0;
+    int r;
+    while ((r = ws_capture_next(capture, &offset, &record)) > 0) {
+        if (num_records == 2 || record.direction != WS_CAPTURE_DIRECTION_OUTGOING ||
+            record.opcode != WS_CAPTURE_OPCODE_TEXT || record.timestamp_ns < last_timestamp_ns ||
+            record.payload_length != 3 || memcmp(record.payload, expected[num_records], 3) != 0) {
+            return false;
+        }
+        last_timestamp_ns = record.timestamp_ns;
+        num_records++;
+    }
+    return r == 0 && num_records == 2;
+}
+
+// records written through create/append/prepare/commit read back through open/next, uncommitted
+// prepares are dropped, and a capture is readable before its writer closed it
+void test_capture(void) {
+    char path[] = "/tmp/ws_capture_testXXXXXX";
+    ws_capture writer;
+    ws_capture reader;
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("FAILED\tcapture\tmkstemp failed\n");
+        return;
+    }
+    close(fd);
+
+    int r = ws_capture_create(&writer, path, 4096);
+    if (r < 0) {
+        printf("FAILED\tcapture\tws_capture_create r=%d\n", r);
+        unlink(path);
+        return;
+    }
+    ws_capture_append(&writer, WS_CAPTURE_DIRECTION_OUTGOING, WS_CAPTURE_OPCODE_TEXT, "abc", 3);
+    ws_capture_prepare(&writer, WS_CAPTURE_DIRECTION_INCOMING, WS_CAPTURE_OPCODE_PING, "hi", 2);
+    ws_capture_prepare(&writer, WS_CAPTURE_DIRECTION_OUTGOING, WS_CAPTURE_OPCODE_TEXT, "def", 3);
+    ws_capture_commit(&writer);
+    ws_capture_prepare(&writer, WS_CAPTURE_DIRECTION_OUTGOING, WS_CAPTURE_OPCODE_TEXT, "dropped", 7);
+
+    bool is_open_readable = ws_capture_open(&reader, path) == 0 && is_capture_test_content(&reader);
+    ws_capture_close(&reader);
+
+    int close_r = ws_capture_close(&writer);
+    bool is_closed_readable = ws_capture_open(&reader, path) == 0 && is_capture_test_content(&reader);
+    ws_capture_close(&reader);
+
+    printf("%s\tcapture\tclose=%d readable_while_open=%d readable_after_close=%d\n",
+           close_r == 0 && is_open_readable && is_closed_readable ? "ok" : "FAILED", close_r, is_open_readable,
+           is_closed_readable);
+    unlink(path);
+}
+
+static int high_watermark_calls = 0;
+static int low_watermark_calls = 0;
+
+static void count_high_watermark(const ws_handle* handle, void* context) {
+    high_watermark_calls++;
+}
+
+static void count_low_watermark(const ws_handle* handle, void* context) {
+    low_watermark_calls++;
+}
+
+static bool is_test_payload(const char* payload, size_t length, int frame) {
+    size_t i;
+    for (i = 0; i < length; ++i) {
+        if (payload[i] != (char) ('a' + frame % 26)) return false;
+    }
+    return length == QUEUE_TEST_PAYLOAD_LENGTH;
+}
+
+// reads what the peer end has, unmasks complete frames and checks them in order
+static void drain_queue_test_peer(int fd, char* stream, size_t* stream_length, int* frames_received, bool* is_intact) {
+    ssize_t r;
+    while ((r = read(fd, stream + *stream_length, QUEUE_TEST_STREAM_LENGTH - *stream_length)) > 0) {
+        *stream_length += (size_t) r;
+
+        size_t pos = 0;
+        _ws_frame_header header;
+        while (_ws_parse_frame_header(stream + pos, *stream_length - pos, &header) == 0) {
+            char* payload = stream + pos + header.header_length;
+            _ws_mask_payload(payload, header.payload_length, (unsigned char*) payload - _WS_HEADER_MASK_SIZE);
+            if (!is_test_payload(payload, header.payload_length, *frames_received)) {
+                *is_intact = false;
+            }
+            (*frames_received)++;
+            pos += header.header_length + header.payload_length;
+        }
+        memmove(stream, stream + pos, *stream_length - pos);
+        *stream_length -= pos;
+    }
+}
+
+// sends through a small socket buffer so writes come back partial and the queue fills up,
+// rejected frames are retried as is
+void test_outbound_queue(void) {
+    static char network_buffer[QUEUE_TEST_PAYLOAD_LENGTH + 64];
+    static char queue_buffer[QUEUE_TEST_QUEUE_LENGTH];
+    static char stream[QUEUE_TEST_STREAM_LENGTH];
+    size_t stream_length = 0;
+    int frames_sent = 0;
+    int frames_received = 0;
+    int queue_full = 0;
+    bool is_rejected_payload_intact = true;
+    bool is_received_intact = true;
+    int fds[2];
+    int sndbuf = 4096;
+    int r = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        printf("outbound queue\tsocketpair failed\n");
+        return;
+    }
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    ws_handle ws;
+    ws_outbound_queue queue;
+    memset(&ws, 0, sizeof(ws));
+    ws.sockfd = fds[0];
+    ws.network_buffer.s = network_buffer;
+    ws.network_buffer.length = sizeof(network_buffer);
+    _ws_init_mask_generator(&ws.mask_generator);
+    ws_set_outbound_queue(&ws, &queue, queue_buffer, sizeof(queue_buffer), QUEUE_TEST_QUEUE_LENGTH / 4,
+                          QUEUE_TEST_QUEUE_LENGTH * 3 / 4, count_high_watermark, count_low_watermark, NULL);
+
+    while (frames_sent < QUEUE_TEST_FRAMES && r >= 0) {
+        char* payload = ws_get_outgoing_payload_ptr(&ws);
+        memset(payload, 'a' + frames_sent % 26, QUEUE_TEST_PAYLOAD_LENGTH);
+        r = ws_send_text(&ws, QUEUE_TEST_PAYLOAD_LENGTH);
+        while (r == WS_ERROR_OUTBOUND_QUEUE_FULL) {
+            queue_full++;
+            if (!is_test_payload(payload, QUEUE_TEST_PAYLOAD_LENGTH, frames_sent)) {
+                is_rejected_payload_intact = false;
+            }
+            drain_queue_test_peer(fds[1], stream, &stream_length, &frames_received, &is_received_intact);
+            r = ws_flush(&ws);
+            if (r >= 0) {
+                r = ws_send_text(&ws, QUEUE_TEST_PAYLOAD_LENGTH);
+            }
+        }
+        if (r == 0) {
+            frames_sent++;
+        }
+    }
+    while (r >= 0 && ws_get_outbound_queued_length(&ws) > 0) {
+        drain_queue_test_peer(fds[1], stream, &stream_length, &frames_received, &is_received_intact);
+        r = ws_flush(&ws);
+    }
+    drain_queue_test_peer(fds[1], stream, &stream_length, &frames_received, &is_received_intact);
+
+    printf("outbound queue\tr=%d\tsent=%d received=%d queue_full=%d high_watermark_calls=%d low_watermark_calls=%d "
+           "rejected_payload_intact=%d received_intact=%d\n", r < 0 ? r : 0, frames_sent, frames_received, queue_full,
+           high_watermark_calls, low_watermark_calls, is_rejected_payload_intact, is_received_intact);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+#ifdef __linux__
+static const char UPGRADE_REQUEST[] =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n";
+
+// a plain blocking socket connected to the loopback server
+static int connect_to_server(const ws_server* server) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(server->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// accepts the one waiting connection and runs the server loop until its handshake is done,
+// returns the OPEN or HANDSHAKE_FAILED event's result, or -1 when neither came
+static int open_server_connection(ws_server* server, ws_handle* handle, void* buffer, unsigned short length) {
+    ws_server_event events[4];
+    bool is_accepted = false;
+    int attempts;
+    for (attempts = 0; attempts < 10; ++attempts) {
+        int n = ws_server_wait(server, events, 4, 1000);
+        int i;
+        for (i = 0; i < n; ++i) {
+            if (events[i].type == WS_SERVER_EVENT_ACCEPT && !is_accepted) {
+                is_accepted = ws_accept(server, handle, buffer, length) == 0;
+            } else if (events[i].type == WS_SERVER_EVENT_OPEN || events[i].type == WS_SERVER_EVENT_HANDSHAKE_FAILED) {
+                return events[i].result;
+            }
+        }
+    }
+    return -1;
+}
+
+// the sha1 and base64 behind Sec-WebSocket-Accept, against the example in RFC 6455 section 1.3
+void test_accept_key(void) {
+    char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+    char accept[_WS_ACCEPT_LENGTH + 1];
+    ws_lstr key_str;
+    key_str.s = key;
+    key_str.length = strlen(key);
+    _ws_compute_accept_key(key_str, accept);
+    printf("%s\taccept key\t%s\n", strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0 ? "ok" : "FAILED", accept);
+}
+
+// a frame sent in the same write as the upgrade request is waiting in ws_receive once the connection opens
+void test_server_open(void) {
+    static char network_buffer[256];
+    static const char masked_frame[] = "\x81\x85" "\x00\x00\x00\x00" "hello";
+    char request[sizeof(UPGRADE_REQUEST) + sizeof(masked_frame)];
+    char response[256];
+    ws_server server;
+    ws_handle handle;
+    ws_received_message_type t = WS_PAYLOAD_TYPE_NONE;
+    struct timeval timeout = {0, 0};
+    char* payload = NULL;
+
+    if (ws_server_init(&server, "127.0.0.1", 0, 4) < 0) {
+        printf("FAILED\tserver open\tws_server_init failed\n");
+        return;
+    }
+    memcpy(request, UPGRADE_REQUEST, sizeof(UPGRADE_REQUEST) - 1);
+    memcpy(request + sizeof(UPGRADE_REQUEST) - 1, masked_frame, sizeof(masked_frame) - 1);
+    int fd = connect_to_server(&server);
+    write(fd, request, sizeof(UPGRADE_REQUEST) - 1 + sizeof(masked_frame) - 1);
+
+    int r = open_server_connection(&server, &handle, network_buffer, sizeof(network_buffer));
+    ssize_t response_length = read(fd, response, sizeof(response) - 1);
+    response[response_length > 0 ? response_length : 0] = 0;
+    int received = r == 0 ? ws_receive(&handle, &t, (void**) &payload, &timeout) : r;
+
+    bool is_ok = r == 0 && strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != NULL &&
+                 received == 5 && t == WS_PAYLOAD_TYPE_TEXT && memcmp(payload, "hello", 5) == 0;
+    printf("%s\tserver open\tr=%d received=%d type=%d\n", is_ok ? "ok" : "FAILED", r, received, t);
+
+    close(fd);
+    if (r == 0) {
+        ws_server_close_connection(&server, &handle);
+    }
+    ws_server_close(&server);
+}
+
+// a subscriber that went away fails the broadcast instead of killing the process with SIGPIPE
+void test_broadcast_to_closed_peer(void) {
+    static char network_buffer[256];
+    ws_server server;
+    ws_handle handle;
+    int results[2] = {0, 0};
+
+    if (ws_server_init(&server, "127.0.0.1", 0, 4) < 0) {
+        printf("FAILED\tbroadcast to closed peer\tws_server_init failed\n");
+        return;
+    }
+    int fd = connect_to_server(&server);
+    write(fd, UPGRADE_REQUEST, sizeof(UPGRADE_REQUEST) - 1);
+    int r = open_server_connection(&server, &handle, network_buffer, sizeof(network_buffer));
+    close(fd);
+
+    ws_handle* subscribers[1] = {&handle};
+    ws_broadcast_text(&server, subscribers, 1, "gone", 4, &results[0]);
+    ws_broadcast_text(&server, subscribers, 1, "gone", 4, &results[1]);
+
+    bool is_ok = r == 0 && results[0] <= 0 && results[1] == WS_ERROR_WRITING_TO_SOCKET;
+    printf("%s\tbroadcast to closed peer\tr=%d first=%d second=%d\n", is_ok ? "ok" : "FAILED", r, results[0],
+           results[1]);
+
+    ws_server_close_connection(&server, &handle);
+    ws_server_close(&server);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int r;
@@ -40,9 +409,30 @@ int main(int argc, char *argv[])
     test_endpoint_parser("/abc", false);
     test_endpoint_parser("/abc", true);
 
-    if(argc != 2)
+    // regressions: prefix compare made http:// and ws:// ssl, 81 characters were left unterminated
+    check_endpoint_parser("http://a.b.c/abc", 0, false, 5);
+    check_endpoint_parser("ws://a.b.c/abc", 0, false, 5);
+    check_endpoint_parser("https://a.b.c/abc", 0, true, 5);
+    check_endpoint_parser("wss://a.b.c/abc", 0, true, 5);
+    check_endpoint_parser("ws://aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/abc", 0, false, 80);
+    check_endpoint_parser("ws://aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/abc",
+                          WS_ERROR_HOSTNAME_TOO_LONG, false, 0);
+    check_handshake_response_parser("HTTP/1.1 101 Switching Protocols", WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR);
+    check_handshake_response_parser("HTTP/1.1 101", WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR);
+    check_handshake_response_parser("HTTP/1.1 101 Switching Protocols\r\n\r\n", 0);
+    test_received_frames();
+
+    test_outbound_queue();
+    test_capture();
+#ifdef __linux__
+    test_accept_key();
+    test_server_open();
+    test_broadcast_to_closed_peer();
+#endif
+
+    if(argc != 2 && argc != 3)
     {
-        printf("\n Usage: %s url \n",argv[0]);
+        printf("\n Usage: %s url [capture_file] \n",argv[0]);
         return 1;
     }
 
@@ -70,17 +460,37 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    ws_capture capture;
+    if (argc == 3)
+    {
+        r = ws_capture_create(&capture, argv[2], CAPTURE_CAPACITY);
+        if (r < 0)
+        {
+            printf("\nError in ws_capture_create: %d\n", r);
+            return 1;
+        }
+        ws_set_capture(&ws, &capture);
+    }
+
 	char *payload = "hello_world! aaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccddaaabbcccdd foobar";
 	size_t payload_length = strlen(payload);
-    memcpy(ws_get_outgoing_payload_ptr(&ws), payload, payload_length);
-    r = ws_send_text(&ws, payload_length);
-    if (r < 0)
+    // frames the server sent right after the handshake stay in the buffer in front of the outgoing payload
+    if (payload_length > ws_get_outgoing_payload_capacity(&ws))
     {
-        printf("\nError in ws_send: %d\n", r);
-        return 1;
+        printf("\nhello message does not fit behind the received frames, not sent\n");
     }
+    else
+    {
+        memcpy(ws_get_outgoing_payload_ptr(&ws), payload, payload_length);
+        r = ws_send_text(&ws, payload_length);
+        if (r < 0)
+        {
+            printf("\nError in ws_send: %d\n", r);
+            return 1;
+        }
 
-	printf("\nsent hello message\n");
+        printf("\nsent hello message\n");
+    }
 
     ws_received_message_type t;
     struct timeval timeout;
@@ -95,6 +505,10 @@ int main(int argc, char *argv[])
             if (r == WS_ERROR_REMOTE_SOCKET_CLOSED)
             {
                 printf("Socket closed by server");
+                if (argc == 3)
+                {
+                    ws_capture_close(&capture);
+                }
                 return 0;
             }
             else
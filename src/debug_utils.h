@@ -9,4 +9,13 @@
 
 void hex_dump (const char *desc, const void *addr, const size_t len);
 
+#ifdef WS_DEBUG
+#include <stdio.h>
+#define DEBUG_PRINTF(...) printf(__VA_ARGS__)
+#define DEBUG_HEX_DUMP(desc, addr, len) hex_dump(desc, addr, len)
+#else
+#define DEBUG_PRINTF(...) do {} while(0)
+#define DEBUG_HEX_DUMP(desc, addr, len) do {} while(0)
+#endif
+
 #endif //WEBSOCKET_C_DEBUG_UTILS_H
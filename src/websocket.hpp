@@ -0,0 +1,566 @@
+#ifndef WEBSOCKET_C_WEBSOCKET_HPP
+#define WEBSOCKET_C_WEBSOCKET_HPP
+
+// Header-only C++20 layer over ws_handle.
+//
+// ws::connection owns the socket and its buffers and is move-only. Payloads are std::spans into the
+// connection's network buffer, so nothing is copied on the way in, and writing into
+// outgoing_payload() before sending avoids the copy on the way out.
+//
+// ws::event_loop (Linux, epoll) runs ws::task coroutines on one thread. async_connect, async_send_text
+// and async_receive suspend until the socket is ready. Their awaiters live in the coroutine frame, so
+// after a session is connected no message allocates. async_connect never blocks the loop, a server that
+// is slow to answer the handshake only holds up its own session until the handshake timeout.
+//
+// The C library shares one network buffer for sending and receiving, so a connection supports one
+// operation at a time, and a received payload is valid until the next operation on the connection.
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "websocket_client.h"
+
+namespace ws {
+
+class error : public std::runtime_error {
+public:
+    error(const char* what, int code) : std::runtime_error(std::string(what) + " failed: " + std::to_string(code)),
+                                        code_(code) {}
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+
+inline int check(int r, const char* what) {
+    if (r < 0) throw error(what, r);
+    return r;
+}
+
+} // namespace detail
+
+enum class message_type : ws_received_message_type {
+    none = WS_PAYLOAD_TYPE_NONE,
+    text = WS_PAYLOAD_TYPE_TEXT,
+    binary = WS_PAYLOAD_TYPE_BINARY,
+    ping = WS_PAYLOAD_TYPE_PING,
+};
+
+struct message {
+    message_type type = message_type::none;
+    std::span<char> payload;
+};
+
+struct connection_options {
+    // ws_init takes the length as unsigned short
+    unsigned short network_buffer_length = 1024;
+    // 0 disables the queue for blocking connections, async connections always get at least one frame's worth
+    std::size_t outbound_queue_length = 0;
+    std::span<const char* const> extra_http_headers;
+    // async_connect fails with WS_ERROR_HANDSHAKE_TIMEOUT if connecting and the handshake take longer
+    std::chrono::milliseconds handshake_timeout{5000};
+};
+
+inline ws_endpoint parse_url(std::string_view url) {
+    // ws_parse_url needs a terminated string
+    std::string terminated(url);
+    ws_endpoint endpoint;
+    detail::check(ws_parse_url(terminated.c_str(), &endpoint, false), "ws_parse_url");
+    return endpoint;
+}
+
+class event_loop;
+
+namespace detail {
+
+// an operation waiting for its socket, lives in the awaiting coroutine's frame.
+// ready() is called from the event loop and must not resume the coroutine inline, only schedule it
+struct waiter {
+    virtual void ready() = 0;
+    // the deadline the waiter registered with the event loop passed
+    virtual void expired() {}
+
+protected:
+    ~waiter() = default;
+};
+
+// heap allocated once per connection so its address can be registered with epoll and
+// the connection itself stays movable
+struct io_state {
+    ws_handle handle{};
+    ws_outbound_queue queue{};
+    std::unique_ptr<char[]> network_buffer;
+    std::unique_ptr<char[]> queue_buffer;
+    bool is_open = false;
+    event_loop* loop = nullptr;
+    waiter* reader = nullptr;
+    waiter* writer = nullptr;
+
+    explicit io_state(const connection_options& options)
+            : network_buffer(new char[options.network_buffer_length]) {
+        handle.sockfd = -1;
+    }
+
+    io_state(const io_state&) = delete;
+    io_state& operator=(const io_state&) = delete;
+    inline ~io_state();
+
+    void attach_queue(std::size_t length) {
+        queue_buffer.reset(new char[length]);
+        check(ws_set_outbound_queue(&handle, &queue, queue_buffer.get(), length, length / 4, length - length / 4,
+                                    nullptr, nullptr, nullptr), "ws_set_outbound_queue");
+    }
+};
+
+} // namespace detail
+
+class task {
+public:
+    struct promise_type {
+        event_loop* loop = nullptr;
+        std::exception_ptr exception;
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            inline void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    task& operator=(task&&) = delete;
+
+    ~task() {
+        if (handle_) handle_.destroy();
+    }
+
+private:
+    friend class event_loop;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+class event_loop {
+public:
+    using clock = std::chrono::steady_clock;
+
+    event_loop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epoll_fd_ < 0) throw error("epoll_create1", WS_ERROR_EPOLL_FAILED);
+    }
+
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    // run() has to return before the loop goes away, suspended tasks are not cleaned up
+    ~event_loop() { ::close(epoll_fd_); }
+
+    void spawn(task t) {
+        auto handle = std::exchange(t.handle_, {});
+        handle.promise().loop = this;
+        live_tasks_++;
+        schedule(handle);
+    }
+
+    // runs until every spawned task finished, rethrows the first exception that escaped a task
+    void run() {
+        epoll_event events[max_events_per_wait];
+        while (true) {
+            while (!ready_.empty()) {
+                running_.swap(ready_);
+                for (auto handle : running_) handle.resume();
+                running_.clear();
+            }
+            if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+            if (live_tasks_ == 0) return;
+
+            int n = epoll_wait(epoll_fd_, events, max_events_per_wait, wait_timeout_ms());
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw error("epoll_wait", WS_ERROR_EPOLL_FAILED);
+            }
+            for (int i = 0; i < n; ++i) dispatch(events[i]);
+            expire_deadlines();
+        }
+    }
+
+    void schedule(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+    // the waiter's expired() is called once the deadline passes, unless it is cancelled before
+    void add_deadline(detail::waiter* waiter, clock::time_point time) {
+        deadlines_.push_back({time, waiter});
+    }
+
+    void cancel_deadline(detail::waiter* waiter) noexcept {
+        deadlines_.erase(std::remove_if(deadlines_.begin(), deadlines_.end(),
+                                        [waiter](const deadline& d) { return d.waiter == waiter; }),
+                         deadlines_.end());
+    }
+
+    // edge triggered, an operation always tries the socket before it waits for the next edge
+    void watch(detail::io_state& state) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = &state;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, state.handle.sockfd, &event) < 0) {
+            throw error("epoll_ctl", WS_ERROR_EPOLL_FAILED);
+        }
+        state.loop = this;
+    }
+
+    void unwatch(detail::io_state& state) noexcept {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, state.handle.sockfd, nullptr);
+        state.loop = nullptr;
+    }
+
+private:
+    friend struct task::promise_type::final_awaiter;
+
+    static constexpr int max_events_per_wait = 256;
+
+    struct deadline {
+        clock::time_point time;
+        detail::waiter* waiter;
+    };
+
+    // how long epoll may sleep before the earliest deadline, -1 for no limit
+    int wait_timeout_ms() const {
+        if (deadlines_.empty()) return -1;
+        auto earliest = std::min_element(deadlines_.begin(), deadlines_.end(),
+                                         [](const deadline& a, const deadline& b) { return a.time < b.time; });
+        auto remaining = earliest->time - clock::now();
+        if (remaining <= clock::duration::zero()) return 0;
+        // rounded up so the deadline has passed once epoll returns
+        return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+    }
+
+    void expire_deadlines() {
+        auto now = clock::now();
+        for (std::size_t i = 0; i < deadlines_.size();) {
+            if (deadlines_[i].time > now) {
+                i++;
+                continue;
+            }
+            detail::waiter* waiter = deadlines_[i].waiter;
+            deadlines_[i] = deadlines_.back();
+            deadlines_.pop_back();
+            waiter->expired();
+        }
+    }
+
+    static void dispatch(const epoll_event& event) {
+        auto* state = static_cast<detail::io_state*>(event.data.ptr);
+        if ((event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && state->reader != nullptr) {
+            std::exchange(state->reader, nullptr)->ready();
+        }
+        if (event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            if (state->writer != nullptr) {
+                std::exchange(state->writer, nullptr)->ready();
+            } else if (ws_get_outbound_queued_length(&state->handle) > 0) {
+                // a failed flush surfaces on the connection's next operation
+                ws_flush(&state->handle);
+            }
+        }
+    }
+
+    void task_finished(std::coroutine_handle<task::promise_type> handle) noexcept {
+        if (handle.promise().exception && !error_) error_ = handle.promise().exception;
+        live_tasks_--;
+        handle.destroy();
+    }
+
+    int epoll_fd_;
+    std::size_t live_tasks_ = 0;
+    std::vector<std::coroutine_handle<>> ready_;
+    std::vector<std::coroutine_handle<>> running_;
+    std::vector<deadline> deadlines_;
+    std::exception_ptr error_;
+};
+
+inline void task::promise_type::final_awaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+    h.promise().loop->task_finished(h);
+}
+
+detail::io_state::~io_state() {
+    if (loop != nullptr) loop->unwatch(*this);
+    if (is_open) ::close(handle.sockfd);
+}
+
+class connection {
+public:
+    class connect_awaiter;
+    class send_awaiter;
+    class receive_awaiter;
+
+    connection(connection&&) noexcept = default;
+    connection& operator=(connection&&) noexcept = default;
+
+    static connection connect(std::string_view url, const connection_options& options = {}) {
+        ws_endpoint endpoint = parse_url(url);
+        auto state = std::make_unique<detail::io_state>(options);
+        detail::check(ws_init(&state->handle, state->network_buffer.get(), options.network_buffer_length, endpoint,
+                              options.extra_http_headers.data(), options.extra_http_headers.size()), "ws_init");
+        state->is_open = true;
+        if (options.outbound_queue_length > 0) state->attach_queue(options.outbound_queue_length);
+        return connection(std::move(state));
+    }
+
+    ws_handle& native_handle() noexcept { return state_->handle; }
+
+    // write the payload here and send it with send_text(length) to skip the copy
+    std::span<char> outgoing_payload() noexcept {
+        return {ws_get_outgoing_payload_ptr(&state_->handle), ws_get_outgoing_payload_capacity(&state_->handle)};
+    }
+
+    void send_text(std::size_t payload_length) {
+        detail::check(ws_send_text(&state_->handle, payload_length), "ws_send_text");
+    }
+
+    void send_text(std::span<const char> payload) {
+        send_text(stage(payload));
+    }
+
+    // the payload has to be the one just received, ws_send_pong only accepts the network buffer
+    void send_pong(std::span<const char> payload) {
+        detail::check(ws_send_pong(&state_->handle, payload.data(), payload.size()), "ws_send_pong");
+    }
+
+    // a message of type none means the timeout expired, a null timeout waits forever
+    message receive(struct timeval* timeout = nullptr) {
+        ws_received_message_type type = WS_PAYLOAD_TYPE_NONE;
+        void* payload = nullptr;
+        int r = detail::check(ws_receive(&state_->handle, &type, &payload, timeout), "ws_receive");
+        return {static_cast<message_type>(type), {static_cast<char*>(payload), static_cast<std::size_t>(r)}};
+    }
+
+    int flush() {
+        return detail::check(ws_flush(&state_->handle), "ws_flush");
+    }
+
+    inline send_awaiter async_send_text(std::size_t payload_length);
+    inline send_awaiter async_send_text(std::span<const char> payload);
+    inline receive_awaiter async_receive();
+
+private:
+    explicit connection(std::unique_ptr<detail::io_state> state) : state_(std::move(state)) {}
+
+    std::size_t stage(std::span<const char> payload) {
+        std::span<char> outgoing = outgoing_payload();
+        if (payload.size() > outgoing.size()) throw error("stage payload", WS_ERROR_BUFFER_TOO_SHORT);
+        if (payload.data() != outgoing.data()) std::memmove(outgoing.data(), payload.data(), payload.size());
+        return payload.size();
+    }
+
+    detail::io_state& async_state() {
+        if (state_->loop == nullptr) throw std::logic_error("connection is not driven by an event_loop");
+        return *state_;
+    }
+
+    std::unique_ptr<detail::io_state> state_;
+};
+
+class connection::connect_awaiter : private detail::waiter {
+public:
+    connect_awaiter(event_loop& loop, ws_endpoint endpoint, const connection_options& options)
+            : loop_(loop), endpoint_(endpoint), options_(options),
+              state_(std::make_unique<detail::io_state>(options)) {}
+
+    bool await_ready() {
+        result_ = ws_connect_begin(&state_->handle, state_->network_buffer.get(), options_.network_buffer_length,
+                                   &endpoint_);
+        if (result_ < 0) return true;
+        state_->is_open = true;
+        loop_.watch(*state_);
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        awaiting_ = awaiting;
+        state_->writer = this;
+        loop_.add_deadline(this, event_loop::clock::now() + options_.handshake_timeout);
+    }
+
+    connection await_resume() {
+        detail::check(result_, "async_connect");
+        std::size_t queue_length = options_.outbound_queue_length;
+        if (queue_length < options_.network_buffer_length) queue_length = options_.network_buffer_length;
+        state_->attach_queue(queue_length);
+        return connection(std::move(state_));
+    }
+
+private:
+    void ready() override {
+        if (!is_handshake_sent_) {
+            result_ = ws_connect_send_handshake(&state_->handle, &endpoint_, options_.extra_http_headers.data(),
+                                                options_.extra_http_headers.size());
+            if (result_ == 0) {
+                is_handshake_sent_ = true;
+                state_->reader = this;
+                return;
+            }
+        } else {
+            result_ = ws_connect_finish(&state_->handle);
+            // the rest of the response comes with a later edge
+            if (result_ == WS_HANDSHAKE_INCOMPLETE) {
+                state_->reader = this;
+                return;
+            }
+        }
+        loop_.cancel_deadline(this);
+        loop_.schedule(awaiting_);
+    }
+
+    void expired() override {
+        state_->reader = nullptr;
+        state_->writer = nullptr;
+        result_ = WS_ERROR_HANDSHAKE_TIMEOUT;
+        loop_.schedule(awaiting_);
+    }
+
+    event_loop& loop_;
+    ws_endpoint endpoint_;
+    connection_options options_;
+    std::unique_ptr<detail::io_state> state_;
+    std::coroutine_handle<> awaiting_;
+    int result_ = 0;
+    bool is_handshake_sent_ = false;
+};
+
+inline connection::connect_awaiter async_connect(event_loop& loop, std::string_view url,
+                                                 const connection_options& options = {}) {
+    return {loop, parse_url(url), options};
+}
+
+// completes once the frame is written or queued. a full outbound queue leaves the payload untouched,
+// so the send is retried as is on the next writable edge
+class connection::send_awaiter : private detail::waiter {
+public:
+    send_awaiter(detail::io_state& state, std::size_t payload_length)
+            : state_(state), payload_length_(payload_length) {}
+
+    bool await_ready() { return try_send(); }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        awaiting_ = awaiting;
+        state_.writer = this;
+    }
+
+    void await_resume() { detail::check(result_, "async_send_text"); }
+
+private:
+    bool try_send() {
+        result_ = ws_send_text(&state_.handle, payload_length_);
+        if (result_ != WS_ERROR_OUTBOUND_QUEUE_FULL) return true;
+
+        int r = ws_flush(&state_.handle);
+        if (r < 0) {
+            result_ = r;
+            return true;
+        }
+        result_ = ws_send_text(&state_.handle, payload_length_);
+        // a frame that doesn't fit an empty queue never will
+        return result_ != WS_ERROR_OUTBOUND_QUEUE_FULL || ws_get_outbound_queued_length(&state_.handle) == 0;
+    }
+
+    void ready() override {
+        if (try_send()) {
+            state_.loop->schedule(awaiting_);
+        } else {
+            state_.writer = this;
+        }
+    }
+
+    detail::io_state& state_;
+    std::size_t payload_length_;
+    std::coroutine_handle<> awaiting_;
+    int result_ = 0;
+};
+
+// ws_receive keeps frames that arrived with the same read in the handle and returns them without
+// touching the socket, so messages sent back to back are not lost waiting for an edge that never
+// comes. it only reports none once a read found the socket drained or the frame still incomplete,
+// and then the next edge is guaranteed
+class connection::receive_awaiter : private detail::waiter {
+public:
+    explicit receive_awaiter(detail::io_state& state) : state_(state) {}
+
+    bool await_ready() { return try_receive(); }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        awaiting_ = awaiting;
+        state_.reader = this;
+    }
+
+    message await_resume() {
+        detail::check(result_, "async_receive");
+        return message_;
+    }
+
+private:
+    bool try_receive() {
+        struct timeval no_wait = {0, 0};
+        ws_received_message_type type = WS_PAYLOAD_TYPE_NONE;
+        void* payload = nullptr;
+        result_ = ws_receive(&state_.handle, &type, &payload, &no_wait);
+        if (result_ < 0) return true;
+        if (type == WS_PAYLOAD_TYPE_NONE) return false;
+        message_ = {static_cast<message_type>(type),
+                    {static_cast<char*>(payload), static_cast<std::size_t>(result_)}};
+        return true;
+    }
+
+    void ready() override {
+        if (try_receive()) {
+            state_.loop->schedule(awaiting_);
+        } else {
+            state_.reader = this;
+        }
+    }
+
+    detail::io_state& state_;
+    std::coroutine_handle<> awaiting_;
+    message message_;
+    int result_ = 0;
+};
+
+connection::send_awaiter connection::async_send_text(std::size_t payload_length) {
+    return {async_state(), payload_length};
+}
+
+connection::send_awaiter connection::async_send_text(std::span<const char> payload) {
+    return {async_state(), stage(payload)};
+}
+
+connection::receive_awaiter connection::async_receive() {
+    return receive_awaiter(async_state());
+}
+
+} // namespace ws
+
+#endif //WEBSOCKET_C_WEBSOCKET_HPP
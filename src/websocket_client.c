@@ -1,15 +1,24 @@
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include <stdio.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <netdb.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#ifndef __APPLE__
+#include <sys/random.h>
+#endif
 #include "debug_utils.h"
 #include "websocket_client.h"
+#include "websocket_internal.h"
+#include "ws_capture.h"
 
-#define _HTTP_HEADER_SEP                "\r\n"
-#define _HTTP_HEADER_SEP_LENGTH         2
 #define _HTTP_REQUEST_LINE              "GET %s HTTP/1.1"
 #define _HTTP_HEADER_HOST               "Host: %s"
 #define _HTTP_STATUS_LINE_BEGIN         "HTTP/"
@@ -27,24 +36,34 @@ static const char* const _HTTP_HEADERS[] = {
         "Sec-WebSocket-Version: 13"
 };
 
-#define _WS_MAX_PAYLOAD_FOR_SHORT_HEADER 125
-#define _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD 6
-#define _WS_FRAME_HEADER_FOR_LONG_PAYLOAD 8
-
-#define _WS_HEADER_FIN_BIT                  (1<<7)
-#define _WS_HEADER_OPCODE_BITMASK           15
-#define _WS_HEADER_OPCODE_TEXT              0x1
-#define _WS_HEADER_OPCODE_BINARY            0x2
-#define _WS_HEADER_OPCODE_PING              0x9
-#define _WS_HEADER_OPCODE_PONG              0xA
-#define _WS_HEADER_MASK_BIT                 (1<<7)
-#define _WS_HEADER_PAYLOAD_LENGTH_BITMASK   127
-#define _WS_PAYLOAD_LENGTH_EXTENDED_16BIT   126
-#define _WS_PAYLOAD_LENGTH_EXTENDED_64BIT   127
-#define _WS_HEADER_MASK_SIZE                4
+// strnstr is BSD only
+char* _ws_strnstr(const char* s, const char* find, size_t slen) {
+    size_t find_length = strlen(find);
+    if (find_length == 0) {
+        return (char*) s;
+    }
+    while (slen >= find_length && *s) {
+        if (*s == *find && strncmp(s, find, find_length) == 0) {
+            return (char*) s;
+        }
+        s++;
+        slen--;
+    }
+    return NULL;
+}
 
+// outgoing payloads go behind any bytes ws_receive hasn't returned yet, so sending doesn't overwrite them
 char* ws_get_outgoing_payload_ptr(const ws_handle* handle) {
-    return handle->network_buffer.s + _WS_FRAME_HEADER_FOR_LONG_PAYLOAD;
+    if (handle->received_length == 0) {
+        return handle->network_buffer.s + _WS_FRAME_HEADER_FOR_LONG_PAYLOAD;
+    }
+    return handle->network_buffer.s + handle->received_offset + handle->received_length +
+           _WS_FRAME_HEADER_FOR_LONG_PAYLOAD;
+}
+
+size_t ws_get_outgoing_payload_capacity(const ws_handle* handle) {
+    size_t payload_offset = (size_t) (ws_get_outgoing_payload_ptr(handle) - handle->network_buffer.s);
+    return payload_offset >= handle->network_buffer.length ? 0 : handle->network_buffer.length - payload_offset;
 }
 
 #define SNPRINTF_SAFE(dest, dest_len, format, ...) \
@@ -57,8 +76,8 @@ char* ws_get_outgoing_payload_ptr(const ws_handle* handle) {
 
 static int _http_handshake_buffer(
         ws_lstr buffer,
-        char* hostname,
-        char* path,
+        const char* hostname,
+        const char* path,
         const char* const extra_headers[],
         const size_t num_extra_headers
 ) {
@@ -81,10 +100,82 @@ static int _http_handshake_buffer(
     return (int) (current_buffer - buffer.s);
 }
 
+static bool _would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+int _ws_set_nonblocking(const int sockfd) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// blocks until the (non-blocking) socket is readable or writable.
+// poll rather than select, server sockets easily go past FD_SETSIZE
+int _ws_wait_for_socket(const int sockfd, const bool for_write) {
+    struct pollfd pfd;
+    int r;
+    pfd.fd = sockfd;
+    pfd.events = for_write ? POLLOUT : POLLIN;
+    do {
+        r = poll(&pfd, 1, -1);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+// drops the first n bytes from the io vector
+static void _iov_consume(struct iovec** iov, int* iov_count, size_t n) {
+    while (n > 0 && *iov_count > 0) {
+        if (n < (*iov)->iov_len) {
+            (*iov)->iov_base = (char*) (*iov)->iov_base + n;
+            (*iov)->iov_len -= n;
+            return;
+        }
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*iov_count)--;
+    }
+}
+
+// writev for sockets: a peer that went away fails the write with EPIPE instead of raising SIGPIPE
+ssize_t _ws_sendv(const int sockfd, struct iovec* iov, const int iov_count) {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = (size_t) iov_count;
+    return sendmsg(sockfd, &message, _WS_SEND_FLAGS);
+}
+
+// writes the whole io vector, resuming partial writes once the socket becomes writable again
+static int _writev_all(const int sockfd, struct iovec* iov, int iov_count, size_t length) {
+    while (length > 0) {
+        ssize_t write_result = _ws_sendv(sockfd, iov, iov_count);
+        if (write_result < 0) {
+            if (errno == EINTR) continue;
+            if (!_would_block() || _ws_wait_for_socket(sockfd, true) < 0) {
+                return WS_ERROR_WRITING_TO_SOCKET;
+            }
+            continue;
+        }
+        _iov_consume(&iov, &iov_count, (size_t) write_result);
+        length -= (size_t) write_result;
+    }
+    return 0;
+}
+
+int _ws_write_all(const int sockfd, const char* buffer, const size_t length) {
+    struct iovec iov;
+    iov.iov_base = (void*) buffer;
+    iov.iov_len = length;
+    return _writev_all(sockfd, &iov, 1, length);
+}
+
 static int _send_http_handshake(
         ws_handle* handle,
-        char* hostname,
-        char* path_and_query,
+        const char* hostname,
+        const char* path_and_query,
         const char* const extra_headers[],
         const size_t num_extra_headers
 ) {
@@ -93,11 +184,10 @@ static int _send_http_handshake(
 
     if (result < 0) return WS_ERROR_BUFFER_TOO_SHORT;
     size_t request_length = (size_t) result;
-    ssize_t write_result = write(handle->sockfd, handle->network_buffer.s, request_length);
-    return write_result == request_length ? 0 : WS_ERROR_WRITING_TO_SOCKET;
+    return _ws_write_all(handle->sockfd, handle->network_buffer.s, request_length);
 }
 
-static int _get_http_status_code_from_status_line(char* line, size_t length) {
+int _ws_get_http_status_code_from_status_line(const char* line, size_t length) {
     if (length < _HTTP_STATUS_LINE_MIN_LENGTH ||
         memcmp(line, _HTTP_STATUS_LINE_BEGIN, _HTTP_STATUS_LINE_BEGIN_LENGTH) != 0) {
         return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
@@ -105,7 +195,7 @@ static int _get_http_status_code_from_status_line(char* line, size_t length) {
 
     size_t i = _HTTP_STATUS_LINE_BEGIN_LENGTH;
     while(i < length && *(line+i) != ' ') i++;
-    if (*(line+i) != ' ') {
+    if (i == length) {
         return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
     }
 
@@ -122,15 +212,16 @@ static int _get_http_status_code_from_status_line(char* line, size_t length) {
     return status_code;
 }
 
-static int _get_http_header(ws_lstr headers, char* header_name, ws_lstr* value) {
+int _ws_get_http_header(ws_lstr headers, const char* header_name, ws_lstr* value) {
     char* pos = headers.s;
     char* header_end;
+    size_t header_name_length = strlen(header_name);
 
     do {
-        hex_dump("header pos", pos, headers.length - (pos - headers.s));
-        header_end = strnstr(pos, _HTTP_HEADER_SEP, headers.length - (pos - headers.s));
+        DEBUG_HEX_DUMP("header pos", pos, headers.length - (pos - headers.s));
+        header_end = _ws_strnstr(pos, _HTTP_HEADER_SEP, headers.length - (pos - headers.s));
         if (header_end == NULL) {
-            printf("PROTOCOL_ERROR: no header end\n");
+            DEBUG_PRINTF("PROTOCOL_ERROR: no header end\n");
             return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
         }
 
@@ -140,17 +231,17 @@ static int _get_http_header(ws_lstr headers, char* header_name, ws_lstr* value)
 
         while (*pos != ':') {
             if (pos >= header_end) {
-                printf("PROTOCOL_ERROR: no colon\n");
+                DEBUG_PRINTF("PROTOCOL_ERROR: no colon\n");
                 return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
             }
             name.length++;
             pos++;
         }
 
-        if (strncasecmp(name.s, header_name, name.length) == 0) {
+        if (name.length == header_name_length && strncasecmp(name.s, header_name, name.length) == 0) {
             pos++; // skip ':'
             if (pos >= header_end) {
-                printf("PROTOCOL_ERROR: no value\n");
+                DEBUG_PRINTF("PROTOCOL_ERROR: no value\n");
                 return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
             }
 
@@ -158,7 +249,7 @@ static int _get_http_header(ws_lstr headers, char* header_name, ws_lstr* value)
             while (*pos == ' ' || *pos == '\t') {
                 pos++;
                 if (pos >= header_end) {
-                    printf("PROTOCOL_ERROR: no value after leading whitespace\n");
+                    DEBUG_PRINTF("PROTOCOL_ERROR: no value after leading whitespace\n");
                     return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
                 }
             }
@@ -172,7 +263,7 @@ static int _get_http_header(ws_lstr headers, char* header_name, ws_lstr* value)
             }
 
             if (value->length == 0) {
-                printf("PROTOCOL_ERROR: no value after trimming trailing whitespace\n");
+                DEBUG_PRINTF("PROTOCOL_ERROR: no value after trimming trailing whitespace\n");
                 return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
             }
 
@@ -180,34 +271,22 @@ static int _get_http_header(ws_lstr headers, char* header_name, ws_lstr* value)
         }
 
         pos = header_end + _HTTP_HEADER_SEP_LENGTH;
-    } while(pos <= headers.s + headers.length && strncmp(pos, _HTTP_HEADER_SEP, _HTTP_HEADER_SEP_LENGTH) != 0);
+    } while(pos + _HTTP_HEADER_SEP_LENGTH <= headers.s + headers.length &&
+            memcmp(pos, _HTTP_HEADER_SEP, _HTTP_HEADER_SEP_LENGTH) != 0);
 
     return 0;
 }
 
-#define _HTTP_RESPONSE_IS_REDIRECT 300
-static int _receive_http_handshake_response(const ws_handle* handle, ws_lstr* redirect_url) {
-    ssize_t read_result = read(handle->sockfd, handle->network_buffer.s, handle->network_buffer.length);
-    if (read_result < 0) {
-        return WS_ERROR_READING_FROM_SOCKET;
-    }
-    if (read_result == 0) {
-        return WS_ERROR_REMOTE_SOCKET_CLOSED;
-    }
-
-    size_t buffer_length = (size_t) read_result;
-
-    printf("http handshake response length %d\n", (int) buffer_length);
-    hex_dump("received http handshake response", handle->network_buffer.s, buffer_length);
-
-    if (buffer_length == handle->network_buffer.length) {
-        return WS_ERROR_BUFFER_TOO_SHORT;
-    }
-
-    char* pos = handle->network_buffer.s;
+// returns 0 on 101, _HTTP_RESPONSE_IS_REDIRECT with redirect_url pointing into the buffer, or an error
+int _ws_parse_http_handshake_response(char* buffer, size_t length, ws_lstr* redirect_url) {
+    char* pos = buffer;
     char* status_line = pos;
-    pos = strnstr(pos, _HTTP_HEADER_SEP, buffer_length);
-    int status_code = _get_http_status_code_from_status_line(status_line, pos - status_line);
+    pos = _ws_strnstr(pos, _HTTP_HEADER_SEP, length);
+    if (pos == NULL) {
+        DEBUG_PRINTF("PROTOCOL_ERROR: no status line end\n");
+        return WS_ERROR_HTTP_HANDSHAKE_PROTOCOL_ERROR;
+    }
+    int status_code = _ws_get_http_status_code_from_status_line(status_line, pos - status_line);
     if (status_code < 0) {
         return status_code;
     }
@@ -216,8 +295,8 @@ static int _receive_http_handshake_response(const ws_handle* handle, ws_lstr* re
         pos += _HTTP_HEADER_SEP_LENGTH;
         ws_lstr headers;
         headers.s = pos;
-        headers.length = buffer_length - (pos - handle->network_buffer.s);
-        int r = _get_http_header(headers, "location", redirect_url);
+        headers.length = length - (pos - buffer);
+        int r = _ws_get_http_header(headers, "location", redirect_url);
         if (r < 0) {
             return r;
         }
@@ -227,152 +306,625 @@ static int _receive_http_handshake_response(const ws_handle* handle, ws_lstr* re
         return _HTTP_RESPONSE_IS_REDIRECT;
     }
     if (status_code != 101) {
-        printf("status code %d", status_code);
+        DEBUG_PRINTF("status code %d", status_code);
         return WS_ERROR_HTTP_HANDSHAKE_HTTP_ERROR;
     }
 
     return 0;
 }
 
-static int _send(const ws_handle* handle, const char opcode, const void* payload, const size_t payload_length) {
-    bool is_long_payload = payload_length > _WS_MAX_PAYLOAD_FOR_SHORT_HEADER ? true : false;
-    int header_length = is_long_payload ?
-                        _WS_FRAME_HEADER_FOR_LONG_PAYLOAD : _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD;
+// reads what the socket has of the response without blocking, accumulating it from the start of the
+// network buffer in received_length. returns WS_HANDSHAKE_INCOMPLETE until the headers are complete.
+// a server may send its first frames right behind them, those bytes are kept for the first ws_receive
+static int _receive_http_handshake_response(ws_handle* handle, ws_lstr* redirect_url) {
+    char* headers_end;
+
+    while (true) {
+        ssize_t read_result = read(handle->sockfd, handle->network_buffer.s + handle->received_length,
+                                   handle->network_buffer.length - handle->received_length);
+        if (read_result < 0) {
+            if (errno == EINTR) continue;
+            return _would_block() ? WS_HANDSHAKE_INCOMPLETE : WS_ERROR_READING_FROM_SOCKET;
+        }
+        if (read_result == 0) {
+            return WS_ERROR_REMOTE_SOCKET_CLOSED;
+        }
+
+        handle->received_length += (size_t) read_result;
+        headers_end = _ws_strnstr(handle->network_buffer.s, _HTTP_HEADERS_END, handle->received_length);
+        if (headers_end != NULL) {
+            break;
+        }
+        if (handle->received_length == handle->network_buffer.length) {
+            return WS_ERROR_BUFFER_TOO_SHORT;
+        }
+    }
+
+    size_t response_length = (size_t) (headers_end - handle->network_buffer.s) + _HTTP_HEADERS_END_LENGTH;
 
-    char* header_start = (char*) (payload - header_length);
-    char* header_pos = header_start;
-    *(header_pos) = (char) (_WS_HEADER_FIN_BIT);
-    *(header_pos) |= opcode;
-    header_pos++;
-    *(header_pos) = (char) (_WS_HEADER_MASK_BIT);
+    DEBUG_PRINTF("http handshake response length %d\n", (int) response_length);
+    DEBUG_HEX_DUMP("received http handshake response", handle->network_buffer.s, response_length);
 
-    if (is_long_payload) {
-        *(header_pos) |= _WS_PAYLOAD_LENGTH_EXTENDED_16BIT;
-        header_pos++;
-        uint16_t l;
-        l = htons(payload_length);
-        memcpy(header_pos, &l, sizeof(uint16_t));
-        header_pos += sizeof(uint16_t);
+    int r = _ws_parse_http_handshake_response(handle->network_buffer.s, response_length, redirect_url);
+    if (r == 0) {
+        size_t received_length = handle->received_length;
+        handle->received_offset = _WS_RECEIVE_HEADROOM;
+        handle->received_length = received_length - response_length;
+        memmove(handle->network_buffer.s + handle->received_offset, handle->network_buffer.s + response_length,
+                handle->received_length);
     }
-    else {
-        *(header_pos) |= payload_length;
-        header_pos++;
+    return r;
+}
+
+static void _enqueue(ws_outbound_queue* queue, const void* data, const size_t length) {
+    size_t tail = (queue->head + queue->queued_length) % queue->buffer.length;
+    size_t first_part = queue->buffer.length - tail;
+    if (first_part > length) first_part = length;
+    memcpy(queue->buffer.s + tail, data, first_part);
+    memcpy(queue->buffer.s, (const char*) data + first_part, length - first_part);
+    queue->queued_length += length;
+}
+
+static void _check_high_watermark(const ws_handle* handle) {
+    ws_outbound_queue* queue = handle->outbound_queue;
+    if (!queue->is_above_high_watermark && queue->queued_length >= queue->high_watermark) {
+        queue->is_above_high_watermark = true;
+        if (queue->on_high_watermark != NULL) {
+            queue->on_high_watermark(handle, queue->callback_context);
+        }
+    }
+}
+
+static void _check_low_watermark(const ws_handle* handle) {
+    ws_outbound_queue* queue = handle->outbound_queue;
+    if (queue->is_above_high_watermark && queue->queued_length <= queue->low_watermark) {
+        queue->is_above_high_watermark = false;
+        if (queue->on_low_watermark != NULL) {
+            queue->on_low_watermark(handle, queue->callback_context);
+        }
     }
+}
+
+// returns the number of bytes still queued
+int ws_flush(const ws_handle* handle) {
+    ws_outbound_queue* queue = handle->outbound_queue;
+    if (queue == NULL) {
+        return 0;
+    }
+
+    while (queue->queued_length > 0) {
+        struct iovec iov[2];
+        int iov_count = 1;
+        size_t first_part = queue->buffer.length - queue->head;
+        if (first_part >= queue->queued_length) {
+            first_part = queue->queued_length;
+        } else {
+            iov[1].iov_base = queue->buffer.s;
+            iov[1].iov_len = queue->queued_length - first_part;
+            iov_count = 2;
+        }
+        iov[0].iov_base = queue->buffer.s + queue->head;
+        iov[0].iov_len = first_part;
+
+        ssize_t write_result = _ws_sendv(handle->sockfd, iov, iov_count);
+        if (write_result < 0) {
+            if (errno == EINTR) continue;
+            if (_would_block()) break;
+            return WS_ERROR_WRITING_TO_SOCKET;
+        }
+        queue->head = (queue->head + (size_t) write_result) % queue->buffer.length;
+        queue->queued_length -= (size_t) write_result;
+    }
+
+    if (queue->queued_length == 0) {
+        queue->head = 0;
+    }
+    _check_low_watermark(handle);
+
+    return (int) queue->queued_length;
+}
+
+size_t ws_get_outbound_queued_length(const ws_handle* handle) {
+    return handle->outbound_queue == NULL ? 0 : handle->outbound_queue->queued_length;
+}
 
-    char* mask = header_pos;
+// frames are queued whole so a full queue never leaves a partial frame on the wire
+static bool _outbound_queue_has_room(const ws_handle* handle, const size_t frame_length) {
+    ws_outbound_queue* queue = handle->outbound_queue;
+    return queue == NULL || frame_length <= queue->buffer.length - queue->queued_length;
+}
+
+// without an outbound queue the frame is written synchronously, otherwise whatever the
+// socket doesn't take right away is queued and written by ws_flush/ws_receive
+int _ws_write_frame(const ws_handle* handle, struct iovec* iov, int iov_count, size_t frame_length) {
+    ws_outbound_queue* queue = handle->outbound_queue;
+    if (queue == NULL) {
+        return _writev_all(handle->sockfd, iov, iov_count, frame_length);
+    }
+
+    if (!_outbound_queue_has_room(handle, frame_length)) {
+        return WS_ERROR_OUTBOUND_QUEUE_FULL;
+    }
+
+    if (queue->queued_length == 0) {
+        while (frame_length > 0) {
+            ssize_t write_result = _ws_sendv(handle->sockfd, iov, iov_count);
+            if (write_result < 0) {
+                if (errno == EINTR) continue;
+                if (_would_block()) break;
+                return WS_ERROR_WRITING_TO_SOCKET;
+            }
+            _iov_consume(&iov, &iov_count, (size_t) write_result);
+            frame_length -= (size_t) write_result;
+        }
+        if (frame_length == 0) {
+            return 0;
+        }
+    }
 
     int i;
-    for (i = 0; i < _WS_HEADER_MASK_SIZE; ++i) {
-        mask[i] = (char) (rand() % 256);
+    for (i = 0; i < iov_count; ++i) {
+        _enqueue(queue, iov[i].iov_base, iov[i].iov_len);
     }
+    _check_high_watermark(handle);
+
+    int r = ws_flush(handle);
+    return r < 0 ? r : 0;
+}
+
+void _ws_init_mask_generator(ws_mask_generator* generator) {
+    // starts empty, the first masked frame fills the block
+    generator->next_key = WS_MASK_KEY_BLOCK_SIZE;
+}
+
+static int _refill_mask_keys(ws_mask_generator* generator) {
+#ifdef __APPLE__
+    arc4random_buf(generator->keys, sizeof(generator->keys));
+#else
+    // requests of up to 256 bytes are never cut short once the entropy pool is initialized
+    ssize_t result;
+    do {
+        result = getrandom(generator->keys, sizeof(generator->keys), 0);
+    } while (result < 0 && errno == EINTR);
 
-    char* payload_byte = (char*) payload;
-    for (i = 0; i < payload_length; ++i) {
-        *payload_byte = *payload_byte ^ mask[i % _WS_HEADER_MASK_SIZE];
-        payload_byte++;
+    if (result != (ssize_t) sizeof(generator->keys)) {
+        DEBUG_PRINTF("getrandom failed: %d\n", errno);
+        return WS_ERROR_RANDOM_FAILED;
+    }
+#endif
+    generator->next_key = 0;
+    return 0;
+}
+
+// hands out the next masking key, one getrandom call covers WS_MASK_KEY_BLOCK_SIZE frames
+int _ws_next_mask_key(ws_mask_generator* generator, const unsigned char** key) {
+    if (generator->next_key >= WS_MASK_KEY_BLOCK_SIZE) {
+        int result = _refill_mask_keys(generator);
+        if (result < 0) return result;
+    }
+
+    *key = generator->keys[generator->next_key];
+    generator->next_key++;
+    return 0;
+}
+
+// xors eight bytes at a time, the payload has no alignment guarantee so words go through memcpy
+void _ws_mask_payload(char* payload, size_t length, const unsigned char* mask) {
+    unsigned char mask_bytes[2 * _WS_HEADER_MASK_SIZE];
+    memcpy(mask_bytes, mask, _WS_HEADER_MASK_SIZE);
+    memcpy(mask_bytes + _WS_HEADER_MASK_SIZE, mask, _WS_HEADER_MASK_SIZE);
+    uint64_t mask_word;
+    memcpy(&mask_word, mask_bytes, sizeof(uint64_t));
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, payload + i, sizeof(uint64_t));
+        word ^= mask_word;
+        memcpy(payload + i, &word, sizeof(uint64_t));
+    }
+    for (; i < length; ++i) {
+        payload[i] = (char) (payload[i] ^ mask[i % _WS_HEADER_MASK_SIZE]);
+    }
+}
+
+// header encoders, one per length class. each writes its header into the space right before
+// the payload and returns where the frame starts.
+
+static char* _encode_short_client_header(char* payload, const char opcode, const size_t payload_length,
+                                         const unsigned char* mask) {
+    char* header = payload - _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD;
+    header[0] = (char) (_WS_HEADER_FIN_BIT | opcode);
+    header[1] = (char) (_WS_HEADER_MASK_BIT | payload_length);
+    memcpy(header + 2, mask, _WS_HEADER_MASK_SIZE);
+    return header;
+}
+
+static char* _encode_16bit_client_header(char* payload, const char opcode, const size_t payload_length,
+                                         const unsigned char* mask) {
+    char* header = payload - _WS_FRAME_HEADER_FOR_LONG_PAYLOAD;
+    uint16_t l = htons((uint16_t) payload_length);
+    header[0] = (char) (_WS_HEADER_FIN_BIT | opcode);
+    header[1] = (char) (_WS_HEADER_MASK_BIT | _WS_PAYLOAD_LENGTH_EXTENDED_16BIT);
+    memcpy(header + 2, &l, sizeof(uint16_t));
+    memcpy(header + 2 + sizeof(uint16_t), mask, _WS_HEADER_MASK_SIZE);
+    return header;
+}
+
+// frames sent by a server are not masked
+static char* _encode_short_server_header(char* payload, const char opcode, const size_t payload_length) {
+    char* header = payload - (_WS_FRAME_HEADER_FOR_SHORT_PAYLOAD - _WS_HEADER_MASK_SIZE);
+    header[0] = (char) (_WS_HEADER_FIN_BIT | opcode);
+    header[1] = (char) payload_length;
+    return header;
+}
+
+static char* _encode_16bit_server_header(char* payload, const char opcode, const size_t payload_length) {
+    char* header = payload - (_WS_FRAME_HEADER_FOR_LONG_PAYLOAD - _WS_HEADER_MASK_SIZE);
+    uint16_t l = htons((uint16_t) payload_length);
+    header[0] = (char) (_WS_HEADER_FIN_BIT | opcode);
+    header[1] = _WS_PAYLOAD_LENGTH_EXTENDED_16BIT;
+    memcpy(header + 2, &l, sizeof(uint16_t));
+    return header;
+}
+
+static char* _encode_64bit_server_header(char* payload, const char opcode, const size_t payload_length) {
+    char* header = payload - (2 + sizeof(uint64_t));
+    uint64_t l = _ws_htonll((uint64_t) payload_length);
+    header[0] = (char) (_WS_HEADER_FIN_BIT | opcode);
+    header[1] = _WS_PAYLOAD_LENGTH_EXTENDED_64BIT;
+    memcpy(header + 2, &l, sizeof(uint64_t));
+    return header;
+}
+
+// picks the server encoder for the length class, shared with ws_broadcast_text
+char* _ws_encode_server_frame_header(char* payload, const char opcode, const size_t payload_length) {
+    if (payload_length <= _WS_MAX_PAYLOAD_FOR_SHORT_HEADER) {
+        return _encode_short_server_header(payload, opcode, payload_length);
+    }
+    if (payload_length <= UINT16_MAX) {
+        return _encode_16bit_server_header(payload, opcode, payload_length);
+    }
+    return _encode_64bit_server_header(payload, opcode, payload_length);
+}
+
+// frames the payload in place, client payloads are masked. payload_length must fit in 16 bits.
+// returns the frame length and sets frame_start
+int _ws_build_frame(ws_handle* handle, const char opcode, void* payload, const size_t payload_length,
+                    char** frame_start) {
+    if (handle->is_server) {
+        *frame_start = _ws_encode_server_frame_header(payload, opcode, payload_length);
+    }
+    else {
+        bool is_long_payload = payload_length > _WS_MAX_PAYLOAD_FOR_SHORT_HEADER;
+        const unsigned char* mask;
+        int result = _ws_next_mask_key(&handle->mask_generator, &mask);
+        if (result < 0) return result;
+
+        *frame_start = is_long_payload ?
+                _encode_16bit_client_header(payload, opcode, payload_length, mask) :
+                _encode_short_client_header(payload, opcode, payload_length, mask);
+        _ws_mask_payload(payload, payload_length, mask);
     }
 
-    size_t frame_length = header_length + payload_length;
-    return write(handle->sockfd, header_start, frame_length) == frame_length ? 0 : WS_ERROR_WRITING_TO_SOCKET;
+    return (int) ((char*) payload - *frame_start + payload_length);
 }
 
-int ws_send_text(const ws_handle* handle, const size_t payload_length) {
+static int _send(ws_handle* handle, const char opcode, const void* payload, const size_t payload_length) {
+    if (payload_length > UINT16_MAX) {
+        // only a 16 bit length fits the header space reserved before the payload
+        return WS_ERROR_PAYLOAD_EXCEEDED_MAX_LENGTH;
+    }
+
+    // checked before the payload is masked in place, so a rejected frame can be sent again as is
+    size_t header_length = payload_length > _WS_MAX_PAYLOAD_FOR_SHORT_HEADER ?
+                           _WS_FRAME_HEADER_FOR_LONG_PAYLOAD : _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD;
+    if (handle->is_server) {
+        header_length -= _WS_HEADER_MASK_SIZE;
+    }
+    if (!_outbound_queue_has_room(handle, header_length + payload_length)) {
+        return WS_ERROR_OUTBOUND_QUEUE_FULL;
+    }
+
+    // recorded before masking but committed only once the frame went out or was queued.
+    // a full capture must not break the connection, recording just stops
+    bool is_captured = handle->capture != NULL &&
+                       ws_capture_prepare(handle->capture, WS_CAPTURE_DIRECTION_OUTGOING, (unsigned char) opcode,
+                                          payload, payload_length) == 0;
+
+    char* frame_start;
+    int frame_length = _ws_build_frame(handle, opcode, (void*) payload, payload_length, &frame_start);
+    if (frame_length < 0) return frame_length;
+
+    struct iovec iov;
+    iov.iov_base = frame_start;
+    iov.iov_len = (size_t) frame_length;
+    int r = _ws_write_frame(handle, &iov, 1, iov.iov_len);
+    if (r == 0 && is_captured) {
+        ws_capture_commit(handle->capture);
+    }
+    return r;
+}
+
+int ws_send_text(ws_handle* handle, const size_t payload_length) {
+    if (payload_length > ws_get_outgoing_payload_capacity(handle)) {
+        return WS_ERROR_BUFFER_TOO_SHORT;
+    }
     return _send(handle, _WS_HEADER_OPCODE_TEXT, ws_get_outgoing_payload_ptr(handle), payload_length);
 }
 
-int ws_send_pong(const ws_handle* handle, const void* payload, const size_t payload_length) {
+int ws_send_pong(ws_handle* handle, const void* payload, const size_t payload_length) {
     if (payload < (void*)handle->network_buffer.s || payload > (void*)(handle->network_buffer.s) + handle->network_buffer.length) {
         return WS_ERROR_INVALID_PONG_PAYLOAD;
     }
     return _send(handle, _WS_HEADER_OPCODE_PONG, payload, payload_length);
 }
 
-// returns payload length
-int ws_receive(const ws_handle* handle, ws_received_message_type* message_type, void** payload,
-               struct timeval* timeout) {
-    fd_set read_fds;
+// checks that the whole frame is in the buffer, a frame split across reads is reported as incomplete
+int _ws_parse_frame_header(const char* frame, size_t length, _ws_frame_header* header) {
+    if (length < 2) {
+        return WS_ERROR_INCOMPLETE_FRAME;
+    }
 
-    FD_ZERO(&read_fds);
-    FD_SET(handle->sockfd, &read_fds);
+    header->is_fin = (_WS_HEADER_FIN_BIT & frame[0]) != 0;
+    header->opcode = (char) (frame[0] & _WS_HEADER_OPCODE_BITMASK);
+    header->is_masked = (_WS_HEADER_MASK_BIT & frame[1]) != 0;
+    header->payload_length = (size_t) (frame[1] & _WS_HEADER_PAYLOAD_LENGTH_BITMASK);
+    header->header_length = 2;
 
-    if (select(handle->sockfd + 1, &read_fds, NULL, NULL, timeout) == 0) {
-        *message_type = WS_PAYLOAD_TYPE_NONE;
-        return 0;
+    if (header->payload_length == _WS_PAYLOAD_LENGTH_EXTENDED_16BIT) {
+        uint16_t payload_length_16bit;
+        if (length < header->header_length + sizeof(uint16_t)) {
+            return WS_ERROR_INCOMPLETE_FRAME;
+        }
+        memcpy(&payload_length_16bit, frame + header->header_length, sizeof(uint16_t));
+        header->payload_length = ntohs(payload_length_16bit);
+        header->header_length += sizeof(uint16_t);
+    }
+    else if (header->payload_length == _WS_PAYLOAD_LENGTH_EXTENDED_64BIT) {
+        uint64_t payload_length_64bit;
+        if (length < header->header_length + sizeof(uint64_t)) {
+            return WS_ERROR_INCOMPLETE_FRAME;
+        }
+        memcpy(&payload_length_64bit, frame + header->header_length, sizeof(uint64_t));
+        payload_length_64bit = _ws_ntohll(payload_length_64bit);
+        if (payload_length_64bit > SIZE_MAX) {
+            return WS_ERROR_PAYLOAD_EXCEEDED_MAX_LENGTH;
+        }
+        header->payload_length = (size_t) payload_length_64bit;
+        header->header_length += sizeof(uint64_t);
     }
 
-    ssize_t buffer_length = read(handle->sockfd, handle->network_buffer.s, handle->network_buffer.length);
+    if (header->is_masked) {
+        header->header_length += _WS_HEADER_MASK_SIZE;
+    }
 
-    if (buffer_length < 0) {
-        return WS_ERROR_READING_FROM_SOCKET;
+    if (length < header->header_length || header->payload_length > length - header->header_length) {
+        return WS_ERROR_INCOMPLETE_FRAME;
     }
-    else if (buffer_length == 0) {
-        *message_type = WS_PAYLOAD_TYPE_NONE;
-        return WS_ERROR_REMOTE_SOCKET_CLOSED;
+
+    return 0;
+}
+
+// moves the bytes ws_receive hasn't returned yet to the front of the buffer, after the headroom
+static void _compact_received(ws_handle* handle) {
+    if (handle->received_offset > _WS_RECEIVE_HEADROOM) {
+        memmove(handle->network_buffer.s + _WS_RECEIVE_HEADROOM,
+                handle->network_buffer.s + handle->received_offset, handle->received_length);
+        handle->received_offset = _WS_RECEIVE_HEADROOM;
     }
+}
 
-    if (buffer_length == handle->network_buffer.length) {
-        return WS_ERROR_BUFFER_TOO_SHORT;
+// takes the next complete frame out of the bytes already read. message_type stays
+// WS_PAYLOAD_TYPE_NONE while the frame is still incomplete. returns payload length
+static int _next_received_frame(ws_handle* handle, ws_received_message_type* message_type, void** payload) {
+    *message_type = WS_PAYLOAD_TYPE_NONE;
+    if (handle->received_length == 0) {
+        return 0;
     }
 
-    char* frame_pos;
-    frame_pos = handle->network_buffer.s;
-    hex_dump("received on socket", frame_pos, (size_t) buffer_length);
-    unsigned char is_fin = (unsigned char) (_WS_HEADER_FIN_BIT & *(frame_pos));
+    char* frame_pos = handle->network_buffer.s + handle->received_offset;
+    _ws_frame_header header;
+    int r = _ws_parse_frame_header(frame_pos, handle->received_length, &header);
+    if (r == WS_ERROR_INCOMPLETE_FRAME) {
+        // kept for the next read, unless the frame already fills the whole buffer
+        if (handle->received_offset == _WS_RECEIVE_HEADROOM &&
+            handle->received_offset + handle->received_length == handle->network_buffer.length) {
+            return WS_ERROR_BUFFER_TOO_SHORT;
+        }
+        return 0;
+    }
+    if (r < 0) {
+        return r;
+    }
+
+    // consumed before it is checked, so a rejected frame doesn't come back on the next call
+    size_t frame_length = header.header_length + header.payload_length;
+    handle->received_offset += frame_length;
+    handle->received_length -= frame_length;
+    if (handle->received_length == 0) {
+        handle->received_offset = _WS_RECEIVE_HEADROOM;
+    }
 
-    if (!is_fin) {
+    if (!header.is_fin) {
         return WS_ERROR_CONTINUATION_NOT_SUPPORTED;
     }
 
-    char op_code = (char) (*(frame_pos) & _WS_HEADER_OPCODE_BITMASK);
+    char op_code = header.opcode;
+    ws_received_message_type type;
     if (op_code == _WS_HEADER_OPCODE_TEXT) {
-        *message_type = WS_PAYLOAD_TYPE_TEXT;
+        type = WS_PAYLOAD_TYPE_TEXT;
     }
     else if (op_code == _WS_HEADER_OPCODE_BINARY) {
-        *message_type = WS_PAYLOAD_TYPE_BINARY;
+        type = WS_PAYLOAD_TYPE_BINARY;
     }
     else if (op_code == _WS_HEADER_OPCODE_PING) {
-        *message_type = WS_PAYLOAD_TYPE_PING;
+        type = WS_PAYLOAD_TYPE_PING;
     }
     else {
         return WS_ERROR_UNSUPPORTED_OPCODE;
     }
 
-    frame_pos++;
+    size_t payload_length = header.payload_length;
+    frame_pos += header.header_length;
 
-    char is_masked = (char) (*(frame_pos) & _WS_HEADER_MASK_BIT);
+    if (header.is_masked) {
+        _ws_mask_payload(frame_pos, payload_length, (unsigned char*) frame_pos - _WS_HEADER_MASK_SIZE);
+    }
+
+    if (handle->capture != NULL) {
+        ws_capture_append(handle->capture, WS_CAPTURE_DIRECTION_INCOMING, (unsigned char) op_code,
+                          frame_pos, payload_length);
+    }
 
-    size_t payload_length = (size_t) (*(frame_pos) & _WS_HEADER_PAYLOAD_LENGTH_BITMASK);
-    frame_pos++;
+    *message_type = type;
+    *payload = frame_pos;
 
-    if (payload_length == _WS_PAYLOAD_LENGTH_EXTENDED_16BIT) {
-        payload_length = ntohs(*((uint16_t*) frame_pos));
-        frame_pos += sizeof(uint16_t);
+    return (int) payload_length;
+}
+
+// returns payload length. frames that arrived with an earlier read, and frames split across
+// reads, stay in the network buffer until they are returned
+int ws_receive(ws_handle* handle, ws_received_message_type* message_type, void** payload,
+               struct timeval* timeout) {
+    int r = _next_received_frame(handle, message_type, payload);
+    if (r != 0 || *message_type != WS_PAYLOAD_TYPE_NONE) {
+        return r;
     }
-    else if (payload_length == _WS_PAYLOAD_LENGTH_EXTENDED_64BIT) {
-        uint64_t payload_length_64bit = ntohll(*((uint64_t*) frame_pos));
-        if (payload_length_64bit > SIZE_MAX) {
-            return WS_ERROR_PAYLOAD_EXCEEDED_MAX_LENGTH;
+
+    struct pollfd pfd;
+    bool has_queued_output = ws_get_outbound_queued_length(handle) > 0;
+    int timeout_ms = timeout == NULL ? -1 : (int) (timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+
+    pfd.fd = handle->sockfd;
+    pfd.events = (short) (has_queued_output ? POLLIN | POLLOUT : POLLIN);
+
+    int poll_result;
+    do {
+        poll_result = poll(&pfd, 1, timeout_ms);
+    } while (poll_result < 0 && errno == EINTR);
+
+    // an invalid fd must not look like an idle connection to a caller looping on ws_receive
+    if (poll_result < 0 || (pfd.revents & POLLNVAL)) {
+        return WS_ERROR_READING_FROM_SOCKET;
+    }
+    if (poll_result == 0) {
+        return 0;
+    }
+
+    if (has_queued_output && (pfd.revents & POLLOUT)) {
+        r = ws_flush(handle);
+        if (r < 0) {
+            return r;
         }
-        payload_length = (size_t) payload_length_64bit;
-        frame_pos += sizeof(uint64_t);
     }
 
-    if (is_masked) {
-        char* mask;
-        mask = frame_pos;
-        frame_pos += _WS_HEADER_MASK_SIZE;
-        char* payload_byte;
-        payload_byte = frame_pos;
-        int i;
-        for (i = 0; i < payload_length; ++i) {
-            *payload_byte = *payload_byte ^ mask[i % _WS_HEADER_MASK_SIZE];
-            payload_byte++;
+    if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+        return 0;
+    }
+
+    _compact_received(handle);
+    size_t read_pos = handle->received_offset + handle->received_length;
+    if (read_pos >= handle->network_buffer.length) {
+        return WS_ERROR_BUFFER_TOO_SHORT;
+    }
+
+    ssize_t read_result = read(handle->sockfd, handle->network_buffer.s + read_pos,
+                               handle->network_buffer.length - read_pos);
+
+    if (read_result < 0) {
+        if (_would_block()) {
+            return 0;
         }
+        return WS_ERROR_READING_FROM_SOCKET;
+    }
+    else if (read_result == 0) {
+        return WS_ERROR_REMOTE_SOCKET_CLOSED;
     }
 
-    *payload = frame_pos;
+    DEBUG_HEX_DUMP("received on socket", handle->network_buffer.s + read_pos, (size_t) read_result);
+    handle->received_length += (size_t) read_result;
 
-    return (int) payload_length;
+    return _next_received_frame(handle, message_type, payload);
+}
+
+// starts a non-blocking connect, the socket becomes writable once it completes
+int ws_connect_begin(
+        ws_handle* handle,
+        void* network_buffer,
+        const unsigned short network_buffer_length,
+        const ws_endpoint* endpoint
+) {
+    struct hostent* he;
+    struct sockaddr_in server_address;
+
+    if ((handle->sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return WS_ERROR_CREATING_SOCKET;
+    }
+
+    if (_ws_set_nonblocking(handle->sockfd) < 0) {
+        close(handle->sockfd);
+        return WS_ERROR_CREATING_SOCKET;
+    }
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(handle->sockfd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+    handle->outbound_queue = NULL;
+    handle->capture = NULL;
+    handle->is_server = false;
+    _ws_init_mask_generator(&handle->mask_generator);
+    handle->network_buffer.s = network_buffer;
+    handle->network_buffer.length = network_buffer_length;
+    // the handshake response accumulates from the start of the buffer, frames behind it move to the headroom
+    handle->received_offset = 0;
+    handle->received_length = 0;
+
+    // name resolution still blocks
+    if ((he = gethostbyname(endpoint->hostname)) == NULL) {
+        close(handle->sockfd);
+        return WS_ERROR_RESOLVING_HOSTNAME;
+    }
+
+    memcpy(&server_address.sin_addr, he->h_addr_list[0], he->h_length);
+
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(endpoint->port);
+
+    if (connect(handle->sockfd, (struct sockaddr*) &server_address, sizeof(server_address)) < 0 &&
+        errno != EINPROGRESS) {
+        close(handle->sockfd);
+        return WS_ERROR_CONNECT_FAILED;
+    }
+
+    return 0;
+}
+
+// call once the socket is writable after ws_connect_begin
+int ws_connect_send_handshake(
+        ws_handle* handle,
+        const ws_endpoint* endpoint,
+        const char* const extra_http_headers[],
+        const size_t num_extra_http_headers
+) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (getsockopt(handle->sockfd, SOL_SOCKET, SO_ERROR, &error, &error_length) < 0 || error != 0) {
+        return WS_ERROR_CONNECT_FAILED;
+    }
+
+    return _send_http_handshake(
+            handle, endpoint->hostname, endpoint->path_and_query, extra_http_headers, num_extra_http_headers
+    );
+}
+
+// call each time the socket is readable after ws_connect_send_handshake, it never blocks and returns
+// WS_HANDSHAKE_INCOMPLETE until the whole response arrived. redirects are only followed by ws_init
+int ws_connect_finish(ws_handle* handle) {
+    ws_lstr redirect_url;
+    int r = _receive_http_handshake_response(handle, &redirect_url);
+    return r == _HTTP_RESPONSE_IS_REDIRECT ? WS_ERROR_HTTP_HANDSHAKE_HTTP_ERROR : r;
 }
 
 int ws_init(
@@ -383,38 +935,25 @@ int ws_init(
         const char* const extra_http_headers[],
         const size_t num_extra_http_headers
 ) {
-    struct hostent* he;
-    struct sockaddr_in server_address;
-
     unsigned short num_redirects = 0;
     int r;
     do {
-        if ((handle->sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-            return WS_ERROR_CREATING_SOCKET;
-        }
-
-        if ((he = gethostbyname(endpoint.hostname)) == NULL) {
-            return WS_ERROR_RESOLVING_HOSTNAME;
-        }
-
-        memcpy(&server_address.sin_addr, he->h_addr_list[0], he->h_length);
-
-        server_address.sin_family = AF_INET;
-        server_address.sin_port = htons(endpoint.port);
+        r = ws_connect_begin(handle, network_buffer, network_buffer_length, &endpoint);
+        if (r < 0) return r;
 
-        if (connect(handle->sockfd, (struct sockaddr*) &server_address, sizeof(server_address)) < 0) {
+        if (_ws_wait_for_socket(handle->sockfd, true) < 0) {
             return WS_ERROR_CONNECT_FAILED;
         }
 
-        handle->network_buffer.s = network_buffer;
-        handle->network_buffer.length = network_buffer_length;
-        r = _send_http_handshake(
-                handle, endpoint.hostname, endpoint.path_and_query, extra_http_headers, num_extra_http_headers
-        );
+        r = ws_connect_send_handshake(handle, &endpoint, extra_http_headers, num_extra_http_headers);
         if (r < 0) return r;
 
         ws_lstr redirect_url;
-        r = _receive_http_handshake_response(handle, &redirect_url);
+        while ((r = _receive_http_handshake_response(handle, &redirect_url)) == WS_HANDSHAKE_INCOMPLETE) {
+            if (_ws_wait_for_socket(handle->sockfd, false) < 0) {
+                return WS_ERROR_READING_FROM_SOCKET;
+            }
+        }
         if (r < 0) return r;
         if (r == _HTTP_RESPONSE_IS_REDIRECT) {
             close(handle->sockfd);
@@ -423,11 +962,11 @@ int ws_init(
                 return WS_ERROR_TOO_MANY_REDIRECTS;
             }
             *(redirect_url.s + redirect_url.length) = 0; // null terminate the url
-            printf("redirect url: '%s'\n", redirect_url.s);
+            DEBUG_PRINTF("redirect url: '%s'\n", redirect_url.s);
             ws_endpoint redirect_endpoint;
             int r2 = ws_parse_url(redirect_url.s, &redirect_endpoint, true);
             if (r2 < 0) {
-                printf("Invalid redirect: %d\n", r2);
+                DEBUG_PRINTF("Invalid redirect: %d\n", r2);
                 return WS_ERROR_INVALID_REDIRECT_URL;
             }
             if (*redirect_endpoint.hostname == 0) { // relative url
@@ -441,8 +980,47 @@ int ws_init(
     return 0;
 }
 
+// must be called after ws_init, frames are recorded unmasked until the capture is closed
+void ws_set_capture(ws_handle* handle, ws_capture* capture) {
+    handle->capture = capture;
+}
+
+// must be called after ws_init, the queue buffer should fit at least the largest frame sent
+int ws_set_outbound_queue(
+        ws_handle* handle,
+        ws_outbound_queue* queue,
+        void* queue_buffer,
+        const size_t queue_buffer_length,
+        const size_t low_watermark,
+        const size_t high_watermark,
+        ws_watermark_callback on_high_watermark,
+        ws_watermark_callback on_low_watermark,
+        void* callback_context
+) {
+    if (queue_buffer_length == 0 || low_watermark >= high_watermark || high_watermark > queue_buffer_length) {
+        return WS_ERROR_INVALID_WATERMARKS;
+    }
+
+    queue->buffer.s = queue_buffer;
+    queue->buffer.length = queue_buffer_length;
+    queue->head = 0;
+    queue->queued_length = 0;
+    queue->low_watermark = low_watermark;
+    queue->high_watermark = high_watermark;
+    queue->is_above_high_watermark = false;
+    queue->on_high_watermark = on_high_watermark;
+    queue->on_low_watermark = on_low_watermark;
+    queue->callback_context = callback_context;
+    handle->outbound_queue = queue;
+    return 0;
+}
+
 static char* const URL_SCHEME_SEPARATOR = "://";
 
+static bool _scheme_equals(const char* scheme, const size_t scheme_length, const char* expected) {
+    return scheme_length == strlen(expected) && strncmp(scheme, expected, scheme_length) == 0;
+}
+
 int ws_parse_url(const char* url, ws_endpoint* endpoint, const bool allow_relative) {
     char* pos = (char*) url;
     char* scheme_separator = strstr(pos, URL_SCHEME_SEPARATOR);
@@ -450,9 +1028,10 @@ int ws_parse_url(const char* url, ws_endpoint* endpoint, const bool allow_relati
         endpoint->is_ssl = false;
     } else {
         size_t scheme_length = scheme_separator - pos;
-        if (strncmp("https", pos, scheme_length) == 0 || strncmp("wss", pos, scheme_length) == 0) {
+        // compare the whole scheme, "http" is a prefix of "https"
+        if (_scheme_equals(pos, scheme_length, "https") || _scheme_equals(pos, scheme_length, "wss")) {
             endpoint->is_ssl = true;
-        } else if (strncmp("http", pos, scheme_length) == 0 || strncmp("ws", pos, scheme_length) == 0) {
+        } else if (_scheme_equals(pos, scheme_length, "http") || _scheme_equals(pos, scheme_length, "ws")) {
             endpoint->is_ssl = false;
         } else {
             return WS_ERROR_INVALID_URL_SCHEME;
@@ -462,7 +1041,7 @@ int ws_parse_url(const char* url, ws_endpoint* endpoint, const bool allow_relati
 
     char* hostname = pos;
     while (*pos && !strchr(":/?#", *pos))
-        if (pos - hostname > WS_MAX_HOSTNAME_LENGTH)
+        if (pos - hostname >= WS_MAX_HOSTNAME_LENGTH)
             return WS_ERROR_HOSTNAME_TOO_LONG;
         else
             pos++;
@@ -509,7 +1088,7 @@ int ws_parse_url(const char* url, ws_endpoint* endpoint, const bool allow_relati
     if (*pos == '/') {
         char* path = pos;
         while (*pos && *pos != '#')
-            if (pos - path > WS_MAX_PATH_AND_QUERY_LENGTH)
+            if (pos - path >= WS_MAX_PATH_AND_QUERY_LENGTH)
                 return WS_ERROR_PATH_AND_QUERY_TOO_LONG;
             else
                 pos++;
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <sys/time.h>
 
 #define WS_ERROR_CREATING_SOCKET                        -1001
 #define WS_ERROR_RESOLVING_HOSTNAME                     -1002
@@ -19,6 +20,10 @@
 #define WS_ERROR_INVALID_PONG_PAYLOAD                   -1013
 #define WS_ERROR_TOO_MANY_REDIRECTS                     -1014
 #define WS_ERROR_INVALID_REDIRECT_URL                   -1015
+#define WS_ERROR_OUTBOUND_QUEUE_FULL                    -1016
+#define WS_ERROR_INVALID_WATERMARKS                     -1017
+#define WS_ERROR_INCOMPLETE_FRAME                       -1018
+#define WS_ERROR_RANDOM_FAILED                          -1019
 #define WS_ERROR_REMOTE_SOCKET_CLOSED                   -1101
 #define WS_ERROR_INVALID_URL_SCHEME                     -1201
 #define WS_ERROR_RELATIVE_URL_NOT_ALLOWED               -1202
@@ -27,7 +32,20 @@
 #define WS_ERROR_HOSTNAME_TOO_LONG                      -1205
 #define WS_ERROR_INVALID_PORT                           -1206
 #define WS_ERROR_PATH_AND_QUERY_TOO_LONG                -1207
+#define WS_ERROR_CAPTURE_FILE                           -1301
+#define WS_ERROR_CAPTURE_FULL                           -1302
+#define WS_ERROR_CAPTURE_CORRUPT                        -1303
+#define WS_ERROR_LISTEN_FAILED                          -1401
+#define WS_ERROR_ACCEPT_FAILED                          -1402
+#define WS_ERROR_NO_PENDING_CONNECTION                  -1403
+#define WS_ERROR_INVALID_UPGRADE_REQUEST                -1404
+#define WS_ERROR_EPOLL_FAILED                           -1405
+#define WS_ERROR_HANDSHAKE_TIMEOUT                      -1406
+#define WS_ERROR_INVALID_BIND_ADDRESS                   -1407
+#define WS_ERROR_HANDSHAKE_PENDING                      -1408
 
+// ws_connect_finish is waiting for the rest of the handshake response
+#define WS_HANDSHAKE_INCOMPLETE                         1
 
 #define WS_PAYLOAD_TYPE_NONE                            0
 #define WS_PAYLOAD_TYPE_TEXT                            1
@@ -37,6 +55,9 @@
 #define WS_MAX_HOSTNAME_LENGTH                          80
 #define WS_MAX_PATH_AND_QUERY_LENGTH                    80
 
+// masking keys fetched per getrandom call, 64 keys is the 256 bytes getrandom never cuts short
+#define WS_MASK_KEY_BLOCK_SIZE                          64
+
 typedef struct {
     size_t length;
     char* s;
@@ -49,13 +70,50 @@ typedef struct {
     bool is_ssl;
 } ws_endpoint;
 
+typedef struct ws_handle ws_handle;
+typedef struct ws_capture ws_capture;
+
+typedef void (*ws_watermark_callback)(const ws_handle* handle, void* context);
+
+// Ring buffer holding frame bytes the socket could not take yet.
+// The storage is provided by the caller and its length is the limit on queued bytes.
 typedef struct {
+    ws_lstr buffer;
+    size_t head;
+    size_t queued_length;
+    size_t low_watermark;
+    size_t high_watermark;
+    bool is_above_high_watermark;
+    ws_watermark_callback on_high_watermark;
+    ws_watermark_callback on_low_watermark;
+    void* callback_context;
+} ws_outbound_queue;
+
+// Block of masking keys taken from the system CSPRNG, handed out one per frame.
+// Refilled when next_key reaches WS_MASK_KEY_BLOCK_SIZE.
+typedef struct {
+    unsigned char keys[WS_MASK_KEY_BLOCK_SIZE][4];
+    unsigned short next_key;
+} ws_mask_generator;
+
+struct ws_handle {
     int sockfd;
     ws_lstr network_buffer;
-} ws_handle;
+    ws_outbound_queue* outbound_queue;
+    ws_capture* capture;
+    bool is_server;
+    ws_mask_generator mask_generator;
+    // bytes read from the socket that ws_receive hasn't returned yet, kept in the network buffer
+    size_t received_offset;
+    size_t received_length;
+};
 
 typedef char ws_received_message_type;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int ws_init(
         ws_handle* handle,
         void* network_buffer,
@@ -65,10 +123,56 @@ int ws_init(
         const size_t num_extra_http_headers
 );
 
+int ws_set_outbound_queue(
+        ws_handle* handle,
+        ws_outbound_queue* queue,
+        void* queue_buffer,
+        const size_t queue_buffer_length,
+        const size_t low_watermark,
+        const size_t high_watermark,
+        ws_watermark_callback on_high_watermark,
+        ws_watermark_callback on_low_watermark,
+        void* callback_context
+);
+
+// non-blocking steps of ws_init, for callers driving their own event loop
+int ws_connect_begin(
+        ws_handle* handle,
+        void* network_buffer,
+        const unsigned short network_buffer_length,
+        const ws_endpoint* endpoint
+);
+int ws_connect_send_handshake(
+        ws_handle* handle,
+        const ws_endpoint* endpoint,
+        const char* const extra_http_headers[],
+        const size_t num_extra_http_headers
+);
+int ws_connect_finish(ws_handle* handle);
+
+void ws_set_capture(ws_handle* handle, ws_capture* capture);
+
+// the outgoing payload goes behind received bytes that ws_receive hasn't returned yet, so check
+// the capacity after receiving instead of assuming the whole network buffer
 char* ws_get_outgoing_payload_ptr(const ws_handle* handle);
-int ws_send_text(const ws_handle* handle, const size_t payload_length);
-int ws_send_pong(const ws_handle* handle, const void* payload, const size_t payload_length);
-int ws_receive(const ws_handle* handle, ws_received_message_type* message_type, void** payload, struct timeval* timeout);
+size_t ws_get_outgoing_payload_capacity(const ws_handle* handle);
+// sending takes the next masking key from the handle, so the handle is not const.
+// WS_ERROR_OUTBOUND_QUEUE_FULL leaves the payload untouched: call again with the same payload
+// once ws_flush or the low watermark callback made room. after any other error the payload may
+// already be masked and has to be written again. ws_receive reuses the network buffer, so a
+// payload that was not sent yet has to be written again after it too
+int ws_send_text(ws_handle* handle, const size_t payload_length);
+int ws_send_pong(ws_handle* handle, const void* payload, const size_t payload_length);
+int ws_flush(const ws_handle* handle);
+size_t ws_get_outbound_queued_length(const ws_handle* handle);
+// the payload stays valid until the next send or receive. frames that came in with the same read
+// are kept in the handle, so keep calling ws_receive until it returns WS_PAYLOAD_TYPE_NONE before
+// waiting on the socket again
+int ws_receive(ws_handle* handle, ws_received_message_type* message_type, void** payload, struct timeval* timeout);
 int ws_parse_url(const char* url, ws_endpoint* endpoint, const bool allow_relative);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //WEBSOCKET_C_WEBSOCKET_CLIENT_H
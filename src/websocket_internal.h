@@ -0,0 +1,86 @@
+#ifndef WEBSOCKET_C_WEBSOCKET_INTERNAL_H
+#define WEBSOCKET_C_WEBSOCKET_INTERNAL_H
+
+// Shared between the client and server implementation, not part of the public api
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "websocket_client.h"
+
+#ifdef __APPLE__
+#include <arpa/inet.h>
+#define _ws_ntohll(x) ntohll(x)
+#define _ws_htonll(x) htonll(x)
+#else
+#include <endian.h>
+#define _ws_ntohll(x) be64toh(x)
+#define _ws_htonll(x) htobe64(x)
+#endif
+
+// sends must not raise SIGPIPE when the peer is gone, apple has SO_NOSIGPIPE on the socket instead
+#ifdef MSG_NOSIGNAL
+#define _WS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define _WS_SEND_FLAGS 0
+#endif
+
+#define _HTTP_HEADER_SEP                "\r\n"
+#define _HTTP_HEADER_SEP_LENGTH         2
+#define _HTTP_HEADERS_END               "\r\n\r\n"
+#define _HTTP_HEADERS_END_LENGTH        4
+
+#define _HTTP_RESPONSE_IS_REDIRECT      300
+
+#define _WS_MAX_PAYLOAD_FOR_SHORT_HEADER 125
+#define _WS_FRAME_HEADER_FOR_SHORT_PAYLOAD 6
+#define _WS_FRAME_HEADER_FOR_LONG_PAYLOAD 8
+
+#define _WS_HEADER_FIN_BIT                  (1<<7)
+#define _WS_HEADER_OPCODE_BITMASK           15
+#define _WS_HEADER_OPCODE_TEXT              0x1
+#define _WS_HEADER_OPCODE_BINARY            0x2
+#define _WS_HEADER_OPCODE_PING              0x9
+#define _WS_HEADER_OPCODE_PONG              0xA
+#define _WS_HEADER_MASK_BIT                 (1<<7)
+#define _WS_HEADER_PAYLOAD_LENGTH_BITMASK   127
+#define _WS_PAYLOAD_LENGTH_EXTENDED_16BIT   126
+#define _WS_PAYLOAD_LENGTH_EXTENDED_64BIT   127
+#define _WS_HEADER_MASK_SIZE                4
+#define _WS_ACCEPT_LENGTH                   28 // base64 of the sha1 digest
+
+// received frames start this far into the network buffer, so a ping can be answered in place
+// with a masked pong header in front of its payload
+#define _WS_RECEIVE_HEADROOM                _WS_FRAME_HEADER_FOR_LONG_PAYLOAD
+
+// the handshake is read to the front of the network buffer with received_offset at 0,
+// completing it moves received frames to the headroom for good
+#define _ws_is_handshake_done(handle)       ((handle)->received_offset >= _WS_RECEIVE_HEADROOM)
+
+typedef struct {
+    bool is_fin;
+    char opcode;
+    bool is_masked;
+    size_t header_length; // including the mask
+    size_t payload_length;
+} _ws_frame_header;
+
+char* _ws_strnstr(const char* s, const char* find, size_t slen);
+int _ws_get_http_status_code_from_status_line(const char* line, size_t length);
+int _ws_get_http_header(ws_lstr headers, const char* header_name, ws_lstr* value);
+int _ws_parse_http_handshake_response(char* buffer, size_t length, ws_lstr* redirect_url);
+int _ws_parse_frame_header(const char* frame, size_t length, _ws_frame_header* header);
+int _ws_set_nonblocking(const int sockfd);
+int _ws_wait_for_socket(const int sockfd, const bool for_write);
+ssize_t _ws_sendv(const int sockfd, struct iovec* iov, const int iov_count);
+int _ws_write_all(const int sockfd, const char* buffer, const size_t length);
+int _ws_write_frame(const ws_handle* handle, struct iovec* iov, int iov_count, size_t frame_length);
+void _ws_init_mask_generator(ws_mask_generator* generator);
+int _ws_next_mask_key(ws_mask_generator* generator, const unsigned char** key);
+void _ws_mask_payload(char* payload, size_t length, const unsigned char* mask);
+void _ws_compute_accept_key(const ws_lstr key, char accept[_WS_ACCEPT_LENGTH + 1]);
+char* _ws_encode_server_frame_header(char* payload, const char opcode, const size_t payload_length);
+int _ws_build_frame(ws_handle* handle, const char opcode, void* payload, const size_t payload_length,
+                    char** frame_start);
+
+#endif //WEBSOCKET_C_WEBSOCKET_INTERNAL_H
@@ -0,0 +1,578 @@
+#define _GNU_SOURCE // accept4
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "debug_utils.h"
+#include "websocket_client.h"
+#include "websocket_internal.h"
+#include "websocket_server.h"
+#include "ws_capture.h"
+
+#define _HTTP_REQUEST_LINE_BEGIN            "GET "
+#define _HTTP_REQUEST_LINE_BEGIN_LENGTH     4
+#define _HTTP_REQUEST_LINE_END              " HTTP/1.1"
+#define _HTTP_REQUEST_LINE_END_LENGTH       9
+#define _HTTP_UPGRADE_RESPONSE              "HTTP/1.1 101 Switching Protocols\r\n" \
+                                            "Upgrade: websocket\r\n" \
+                                            "Connection: Upgrade\r\n" \
+                                            "Sec-WebSocket-Accept: %s\r\n\r\n"
+#define _HTTP_BAD_REQUEST_RESPONSE          "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n"
+
+#define _WS_ACCEPT_GUID                     "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define _WS_ACCEPT_GUID_LENGTH              36
+#define _WS_MAX_KEY_LENGTH                  64
+#define _WS_SHA1_DIGEST_LENGTH              20
+#define _WS_VERSION                         "13"
+
+#define _WS_MAX_SERVER_FRAME_HEADER         10
+#define _SERVER_MAX_EVENTS_PER_WAIT         256
+
+#define _SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void _sha1_block(uint32_t state[5], const unsigned char block[64]) {
+    uint32_t w[80];
+    int i;
+    for (i = 0; i < 16; ++i) {
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16 |
+               (uint32_t) block[i * 4 + 2] << 8 | (uint32_t) block[i * 4 + 3];
+    }
+    for (i = 16; i < 80; ++i) {
+        w[i] = _SHA1_ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = _SHA1_ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = _SHA1_ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+// only used on the short handshake key, so everything is done in one go
+static void _sha1(const unsigned char* data, const size_t length, unsigned char digest[_WS_SHA1_DIGEST_LENGTH]) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    unsigned char block[64];
+    size_t offset = 0;
+
+    while (length - offset >= 64) {
+        _sha1_block(state, data + offset);
+        offset += 64;
+    }
+
+    size_t remaining = length - offset;
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + offset, remaining);
+    block[remaining] = 0x80;
+    if (remaining >= 56) {
+        _sha1_block(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    uint64_t bit_length = (uint64_t) length * 8;
+    int i;
+    for (i = 0; i < 8; ++i) {
+        block[63 - i] = (unsigned char) (bit_length >> (i * 8));
+    }
+    _sha1_block(state, block);
+
+    for (i = 0; i < 5; ++i) {
+        digest[i * 4] = (unsigned char) (state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char) (state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char) (state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char) state[i];
+    }
+}
+
+static const char _BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// dest must fit 4 * ceil(length / 3) + 1 bytes
+static void _base64_encode(const unsigned char* data, const size_t length, char* dest) {
+    size_t i;
+    for (i = 0; i + 2 < length; i += 3) {
+        uint32_t v = (uint32_t) data[i] << 16 | (uint32_t) data[i + 1] << 8 | data[i + 2];
+        *dest++ = _BASE64_ALPHABET[(v >> 18) & 63];
+        *dest++ = _BASE64_ALPHABET[(v >> 12) & 63];
+        *dest++ = _BASE64_ALPHABET[(v >> 6) & 63];
+        *dest++ = _BASE64_ALPHABET[v & 63];
+    }
+    if (i < length) {
+        uint32_t v = (uint32_t) data[i] << 16;
+        if (i + 1 < length) v |= (uint32_t) data[i + 1] << 8;
+        *dest++ = _BASE64_ALPHABET[(v >> 18) & 63];
+        *dest++ = _BASE64_ALPHABET[(v >> 12) & 63];
+        *dest++ = i + 1 < length ? _BASE64_ALPHABET[(v >> 6) & 63] : '=';
+        *dest++ = '=';
+    }
+    *dest = 0;
+}
+
+void _ws_compute_accept_key(const ws_lstr key, char accept[_WS_ACCEPT_LENGTH + 1]) {
+    unsigned char concatenated[_WS_MAX_KEY_LENGTH + _WS_ACCEPT_GUID_LENGTH];
+    unsigned char digest[_WS_SHA1_DIGEST_LENGTH];
+    memcpy(concatenated, key.s, key.length);
+    memcpy(concatenated + key.length, _WS_ACCEPT_GUID, _WS_ACCEPT_GUID_LENGTH);
+    _sha1(concatenated, key.length + _WS_ACCEPT_GUID_LENGTH, digest);
+    _base64_encode(digest, _WS_SHA1_DIGEST_LENGTH, accept);
+}
+
+static bool _header_equals(ws_lstr headers, const char* header_name, const char* expected) {
+    ws_lstr value;
+    return _ws_get_http_header(headers, header_name, &value) == 1 &&
+           value.length == strlen(expected) && strncasecmp(value.s, expected, value.length) == 0;
+}
+
+// reads what the client sent so far without blocking, the request accumulates in received_length.
+// returns 1 once the request headers are complete, 0 while they are not
+static int _receive_upgrade_request(ws_handle* handle, size_t* request_length) {
+    // keep room for a terminating 0, the header parser relies on it
+    size_t capacity = handle->network_buffer.length - 1;
+
+    while (true) {
+        ssize_t read_result = read(handle->sockfd, handle->network_buffer.s + handle->received_length,
+                                   capacity - handle->received_length);
+        if (read_result < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : WS_ERROR_READING_FROM_SOCKET;
+        }
+        if (read_result == 0) {
+            return WS_ERROR_REMOTE_SOCKET_CLOSED;
+        }
+
+        handle->received_length += (size_t) read_result;
+        handle->network_buffer.s[handle->received_length] = 0;
+        char* headers_end = _ws_strnstr(handle->network_buffer.s, _HTTP_HEADERS_END, handle->received_length);
+        if (headers_end != NULL) {
+            *request_length = (size_t) (headers_end - handle->network_buffer.s) + _HTTP_HEADERS_END_LENGTH;
+            return 1;
+        }
+        if (handle->received_length == capacity) {
+            return WS_ERROR_BUFFER_TOO_SHORT;
+        }
+    }
+}
+
+// returns 1 once the handshake completed, 0 while the request is incomplete
+static int _handle_upgrade_request(ws_handle* handle) {
+    size_t request_length;
+    int r = _receive_upgrade_request(handle, &request_length);
+    if (r <= 0) {
+        return r;
+    }
+
+    DEBUG_HEX_DUMP("received upgrade request", handle->network_buffer.s, request_length);
+
+    char* request_line = handle->network_buffer.s;
+    char* request_line_end = _ws_strnstr(request_line, _HTTP_HEADER_SEP, request_length);
+    size_t request_line_length = (size_t) (request_line_end - request_line);
+    if (request_line_length < _HTTP_REQUEST_LINE_BEGIN_LENGTH + _HTTP_REQUEST_LINE_END_LENGTH ||
+        memcmp(request_line, _HTTP_REQUEST_LINE_BEGIN, _HTTP_REQUEST_LINE_BEGIN_LENGTH) != 0 ||
+        memcmp(request_line_end - _HTTP_REQUEST_LINE_END_LENGTH, _HTTP_REQUEST_LINE_END,
+               _HTTP_REQUEST_LINE_END_LENGTH) != 0) {
+        DEBUG_PRINTF("PROTOCOL_ERROR: invalid request line\n");
+        return WS_ERROR_INVALID_UPGRADE_REQUEST;
+    }
+
+    ws_lstr headers;
+    headers.s = request_line_end + _HTTP_HEADER_SEP_LENGTH;
+    headers.length = request_length - (headers.s - handle->network_buffer.s);
+
+    ws_lstr key;
+    if (!_header_equals(headers, "upgrade", "websocket") ||
+        !_header_equals(headers, "sec-websocket-version", _WS_VERSION) ||
+        _ws_get_http_header(headers, "sec-websocket-key", &key) != 1 ||
+        key.length > _WS_MAX_KEY_LENGTH) {
+        DEBUG_PRINTF("PROTOCOL_ERROR: not a websocket upgrade request\n");
+        return WS_ERROR_INVALID_UPGRADE_REQUEST;
+    }
+
+    char accept[_WS_ACCEPT_LENGTH + 1];
+    _ws_compute_accept_key(key, accept);
+
+    // built outside the network buffer, which still holds the frames behind the request.
+    // a fresh socket always takes it whole, so the server loop never waits on a slow client here
+    char response[sizeof(_HTTP_UPGRADE_RESPONSE) + _WS_ACCEPT_LENGTH];
+    int response_length = snprintf(response, sizeof(response), _HTTP_UPGRADE_RESPONSE, accept);
+    if (send(handle->sockfd, response, (size_t) response_length, _WS_SEND_FLAGS) != response_length) {
+        return WS_ERROR_WRITING_TO_SOCKET;
+    }
+
+    size_t received_length = handle->received_length;
+    handle->received_offset = _WS_RECEIVE_HEADROOM;
+    handle->received_length = received_length - request_length;
+    memmove(handle->network_buffer.s + handle->received_offset, handle->network_buffer.s + request_length,
+            handle->received_length);
+    return 1;
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static bool _is_handshake_slot(const ws_server* server, const void* ptr) {
+    return (uintptr_t) ptr >= (uintptr_t) server->handshakes &&
+           (uintptr_t) ptr < (uintptr_t) (server->handshakes + WS_SERVER_MAX_PENDING_HANDSHAKES);
+}
+
+// the listening socket is only watched while there is a free handshake slot
+static void _watch_listen_socket(ws_server* server, const bool is_accepting) {
+    struct epoll_event event;
+    event.events = is_accepting ? EPOLLIN : 0;
+    event.data.ptr = NULL;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, server->listen_fd, &event);
+}
+
+// the last pending handshake moves into the freed slot, so epoll has to point at its new place
+static void _remove_handshake(ws_server* server, ws_server_handshake* slot) {
+    ws_server_handshake* last = &server->handshakes[server->num_handshakes - 1];
+    if (slot != last) {
+        struct epoll_event event;
+        *slot = *last;
+        event.events = EPOLLIN;
+        event.data.ptr = slot;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, slot->handle->sockfd, &event);
+    }
+    if (server->num_handshakes == WS_SERVER_MAX_PENDING_HANDSHAKES) {
+        _watch_listen_socket(server, true);
+    }
+    server->num_handshakes--;
+}
+
+static ws_server_handshake* _find_handshake(ws_server* server, const ws_handle* handle) {
+    size_t i;
+    for (i = 0; i < server->num_handshakes; ++i) {
+        if (server->handshakes[i].handle == handle) {
+            return &server->handshakes[i];
+        }
+    }
+    return NULL;
+}
+
+// returns the failed connection's handle, the slot is reused right away
+static ws_handle* _fail_handshake(ws_server* server, ws_server_handshake* slot, const int result) {
+    ws_handle* handle = slot->handle;
+    if (result == WS_ERROR_INVALID_UPGRADE_REQUEST || result == WS_ERROR_BUFFER_TOO_SHORT) {
+        // best effort, the connection is closed either way
+        if (send(handle->sockfd, _HTTP_BAD_REQUEST_RESPONSE, strlen(_HTTP_BAD_REQUEST_RESPONSE), _WS_SEND_FLAGS) < 0) {
+            DEBUG_PRINTF("writing bad request response failed: %d\n", errno);
+        }
+    }
+    _remove_handshake(server, slot);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, handle->sockfd, NULL);
+    close(handle->sockfd);
+    return handle;
+}
+
+// the handle is registered with epoll under its own address from now on
+static ws_handle* _open_handshake(ws_server* server, ws_server_handshake* slot) {
+    ws_handle* handle = slot->handle;
+    struct epoll_event event;
+    _remove_handshake(server, slot);
+    event.events = EPOLLIN;
+    event.data.ptr = handle;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, handle->sockfd, &event);
+    return handle;
+}
+
+// how long epoll may sleep before the next pending handshake times out, -1 for no limit
+static int _wait_timeout_ms(const ws_server* server, const uint64_t now_ns, const uint64_t deadline_ns,
+                            const int timeout_ms) {
+    uint64_t wake_ns = timeout_ms < 0 ? UINT64_MAX : deadline_ns;
+    size_t i;
+    for (i = 0; i < server->num_handshakes; ++i) {
+        if (server->handshakes[i].deadline_ns < wake_ns) {
+            wake_ns = server->handshakes[i].deadline_ns;
+        }
+    }
+    if (wake_ns == UINT64_MAX) {
+        return -1;
+    }
+    // rounded up so the deadline has passed once epoll returns
+    return wake_ns <= now_ns ? 0 : (int) ((wake_ns - now_ns + 999999) / 1000000);
+}
+
+// closes handshakes past their deadline and reports them, as long as there is room for events
+static int _expire_handshakes(ws_server* server, ws_server_event* events, int num_events, const int max_events) {
+    uint64_t now_ns = _now_ns();
+    size_t i = 0;
+    while (i < server->num_handshakes && num_events < max_events) {
+        if (server->handshakes[i].deadline_ns > now_ns) {
+            i++;
+            continue;
+        }
+        // the failed slot is refilled with the last one, which is checked next
+        events[num_events].type = WS_SERVER_EVENT_HANDSHAKE_FAILED;
+        events[num_events].handle = _fail_handshake(server, &server->handshakes[i], WS_ERROR_HANDSHAKE_TIMEOUT);
+        events[num_events].result = WS_ERROR_HANDSHAKE_TIMEOUT;
+        num_events++;
+    }
+    return num_events;
+}
+
+int ws_server_init(ws_server* server, const char* bind_address, const unsigned short port, const int backlog) {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    struct epoll_event event;
+    int enable = 1;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (bind_address == NULL) {
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if (inet_pton(AF_INET, bind_address, &address.sin_addr) != 1) {
+        return WS_ERROR_INVALID_BIND_ADDRESS;
+    }
+
+    if ((server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        return WS_ERROR_CREATING_SOCKET;
+    }
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (bind(server->listen_fd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+        listen(server->listen_fd, backlog) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr*) &address, &address_length) < 0) {
+        close(server->listen_fd);
+        return WS_ERROR_LISTEN_FAILED;
+    }
+    server->port = ntohs(address.sin_port);
+    server->handshake_timeout_ms = WS_SERVER_DEFAULT_HANDSHAKE_TIMEOUT_MS;
+    server->num_handshakes = 0;
+
+    if ((server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        close(server->listen_fd);
+        return WS_ERROR_EPOLL_FAILED;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) < 0) {
+        ws_server_close(server);
+        return WS_ERROR_EPOLL_FAILED;
+    }
+
+    return 0;
+}
+
+// accepts one pending connection without waiting for its upgrade request. ws_server_wait reads
+// the request as it arrives and reports WS_SERVER_EVENT_OPEN once the handshake completed, or
+// WS_SERVER_EVENT_HANDSHAKE_FAILED when the request is invalid or not complete within
+// server->handshake_timeout_ms. returns WS_ERROR_NO_PENDING_CONNECTION while
+// WS_SERVER_MAX_PENDING_HANDSHAKES handshakes are in progress, the clients wait in the listen backlog
+int ws_accept(
+        ws_server* server,
+        ws_handle* handle,
+        void* network_buffer,
+        const unsigned short network_buffer_length
+) {
+    struct epoll_event event;
+
+    if (server->num_handshakes == WS_SERVER_MAX_PENDING_HANDSHAKES) {
+        return WS_ERROR_NO_PENDING_CONNECTION;
+    }
+
+    handle->sockfd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (handle->sockfd < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? WS_ERROR_NO_PENDING_CONNECTION : WS_ERROR_ACCEPT_FAILED;
+    }
+
+    handle->network_buffer.s = network_buffer;
+    handle->network_buffer.length = network_buffer_length;
+    // the request is read to the front of the buffer, received frames move behind the headroom later
+    handle->received_offset = 0;
+    handle->received_length = 0;
+    handle->outbound_queue = NULL;
+    handle->capture = NULL;
+    handle->is_server = true;
+    _ws_init_mask_generator(&handle->mask_generator);
+
+    ws_server_handshake* slot = &server->handshakes[server->num_handshakes];
+    event.events = EPOLLIN;
+    event.data.ptr = slot;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, handle->sockfd, &event) < 0) {
+        close(handle->sockfd);
+        return WS_ERROR_EPOLL_FAILED;
+    }
+
+    slot->handle = handle;
+    slot->deadline_ns = _now_ns() + (uint64_t) server->handshake_timeout_ms * 1000000ULL;
+    server->num_handshakes++;
+    if (server->num_handshakes == WS_SERVER_MAX_PENDING_HANDSHAKES) {
+        _watch_listen_socket(server, false);
+    }
+
+    return 0;
+}
+
+// returns the number of events, 0 once timeout_ms passed without any. connections that only became
+// writable have their outbound queue flushed here and are not reported
+int ws_server_wait(ws_server* server, ws_server_event* events, const int max_events, const int timeout_ms) {
+    struct epoll_event epoll_events[_SERVER_MAX_EVENTS_PER_WAIT];
+    uint64_t deadline_ns = timeout_ms < 0 ? 0 : _now_ns() + (uint64_t) timeout_ms * 1000000ULL;
+    int num_events = 0;
+
+    while (true) {
+        uint64_t now_ns = _now_ns();
+        int n = epoll_wait(server->epoll_fd, epoll_events,
+                           max_events < _SERVER_MAX_EVENTS_PER_WAIT ? max_events : _SERVER_MAX_EVENTS_PER_WAIT,
+                           _wait_timeout_ms(server, now_ns, deadline_ns, timeout_ms));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return WS_ERROR_EPOLL_FAILED;
+        }
+
+        int i;
+        for (i = 0; i < n; ++i) {
+            void* ptr = epoll_events[i].data.ptr;
+
+            if (ptr == NULL) {
+                events[num_events].type = WS_SERVER_EVENT_ACCEPT;
+                events[num_events].handle = NULL;
+                events[num_events].result = 0;
+                num_events++;
+                continue;
+            }
+
+            if (_is_handshake_slot(server, ptr)) {
+                ws_server_handshake* slot = ptr;
+                // the handshake in this slot moved to a freed one earlier in the batch, epoll already
+                // points at its new slot and reports it again with the next wait
+                if (slot >= server->handshakes + server->num_handshakes) continue;
+                int r = _handle_upgrade_request(slot->handle);
+                if (r == 0) continue;
+                events[num_events].type = r > 0 ? WS_SERVER_EVENT_OPEN : WS_SERVER_EVENT_HANDSHAKE_FAILED;
+                events[num_events].handle = r > 0 ? _open_handshake(server, slot) : _fail_handshake(server, slot, r);
+                events[num_events].result = r > 0 ? 0 : r;
+                num_events++;
+                continue;
+            }
+
+            ws_handle* handle = ptr;
+
+            if (epoll_events[i].events & EPOLLOUT) {
+                // a failed flush shows up as an error on the next ws_receive
+                if (ws_flush(handle) == 0) {
+                    struct epoll_event event;
+                    event.events = EPOLLIN;
+                    event.data.ptr = handle;
+                    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, handle->sockfd, &event);
+                }
+            }
+
+            if (epoll_events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                events[num_events].type = WS_SERVER_EVENT_READABLE;
+                events[num_events].handle = handle;
+                events[num_events].result = 0;
+                num_events++;
+            }
+        }
+
+        num_events = _expire_handshakes(server, events, num_events, max_events);
+        if (num_events > 0 || (timeout_ms >= 0 && _now_ns() >= deadline_ns)) {
+            return num_events;
+        }
+    }
+}
+
+// call when a send left bytes in the handle's outbound queue, ws_server_wait flushes them
+int ws_server_watch_output(ws_server* server, const ws_handle* handle) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = (void*) handle;
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, handle->sockfd, &event) < 0 ? WS_ERROR_EPOLL_FAILED : 0;
+}
+
+// frames the payload once and writes the same header and payload bytes to every handle.
+// the payload can live anywhere and is not copied unless a handle has to queue it.
+// handles without an outbound queue are written synchronously, so a slow one stalls the rest.
+// handles still in the upgrade handshake are skipped with WS_ERROR_HANDSHAKE_PENDING, a frame must not
+// go out before the 101 response, so only pass handles once WS_SERVER_EVENT_OPEN reported them.
+// returns the number of failed handles, results (optional) gets each handle's result
+int ws_broadcast_text(
+        ws_server* server,
+        ws_handle* const handles[],
+        const size_t num_handles,
+        const void* payload,
+        const size_t payload_length,
+        int results[]
+) {
+    char header[_WS_MAX_SERVER_FRAME_HEADER];
+    char* header_end = header + _WS_MAX_SERVER_FRAME_HEADER;
+    char* header_start = _ws_encode_server_frame_header(header_end, _WS_HEADER_OPCODE_TEXT, payload_length);
+    size_t header_length = (size_t) (header_end - header_start);
+    int num_failed = 0;
+    size_t i;
+
+    for (i = 0; i < num_handles; ++i) {
+        struct iovec iov[2];
+        iov[0].iov_base = header_start;
+        iov[0].iov_len = header_length;
+        iov[1].iov_base = (void*) payload;
+        iov[1].iov_len = payload_length;
+
+        int r = _ws_is_handshake_done(handles[i]) ?
+                _ws_write_frame(handles[i], iov, 2, header_length + payload_length) : WS_ERROR_HANDSHAKE_PENDING;
+        if (r == 0 && handles[i]->capture != NULL) {
+            // the payload is never masked, so it is recorded only once it went out or was queued
+            ws_capture_append(handles[i]->capture, WS_CAPTURE_DIRECTION_OUTGOING, _WS_HEADER_OPCODE_TEXT,
+                              payload, payload_length);
+        }
+        if (r == 0 && ws_get_outbound_queued_length(handles[i]) > 0) {
+            r = ws_server_watch_output(server, handles[i]);
+        }
+        if (results != NULL) {
+            results[i] = r;
+        }
+        if (r < 0) {
+            num_failed++;
+        }
+    }
+
+    return num_failed;
+}
+
+void ws_server_close_connection(ws_server* server, ws_handle* handle) {
+    ws_server_handshake* slot = _ws_is_handshake_done(handle) ? NULL : _find_handshake(server, handle);
+    if (slot != NULL) {
+        _remove_handshake(server, slot);
+    }
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, handle->sockfd, NULL);
+    close(handle->sockfd);
+}
+
+void ws_server_close(ws_server* server) {
+    close(server->epoll_fd);
+    close(server->listen_fd);
+}
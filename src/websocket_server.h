@@ -0,0 +1,75 @@
+#ifndef WEBSOCKET_C_WEBSOCKET_SERVER_H
+#define WEBSOCKET_C_WEBSOCKET_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "websocket_client.h"
+
+// Server mode (Linux, epoll). Accepted connections are regular ws_handles with is_server set,
+// so ws_receive, ws_send_text, ws_send_pong and the outbound queue work on them unchanged.
+// A readable connection may carry several frames: call ws_receive until it returns
+// WS_PAYLOAD_TYPE_NONE, frames already read are not reported by ws_server_wait again.
+
+#define WS_SERVER_DEFAULT_HANDSHAKE_TIMEOUT_MS          5000
+// connections still in the upgrade handshake, further clients wait in the listen backlog
+#define WS_SERVER_MAX_PENDING_HANDSHAKES                256
+
+// connections are waiting, call ws_accept until WS_ERROR_NO_PENDING_CONNECTION. handle is NULL
+#define WS_SERVER_EVENT_ACCEPT                          0
+// the handshake completed, frames the client sent right away may already be waiting in ws_receive
+#define WS_SERVER_EVENT_OPEN                            1
+#define WS_SERVER_EVENT_READABLE                        2
+// the connection is already closed and the handle can be reused, result has the reason
+#define WS_SERVER_EVENT_HANDSHAKE_FAILED                3
+
+typedef struct {
+    ws_handle* handle;
+    uint64_t deadline_ns;
+} ws_server_handshake;
+
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    unsigned short port;
+    int handshake_timeout_ms; // can be changed after ws_server_init, applies to later ws_accept calls
+    // epoll points at the slot while the handshake is pending, at the handle once it is open
+    ws_server_handshake handshakes[WS_SERVER_MAX_PENDING_HANDSHAKES];
+    size_t num_handshakes;
+} ws_server;
+
+typedef struct {
+    int type;
+    ws_handle* handle; // NULL when connections are waiting to be accepted
+    int result;
+} ws_server_event;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ws_server_init(ws_server* server, const char* bind_address, const unsigned short port, const int backlog);
+int ws_accept(
+        ws_server* server,
+        ws_handle* handle,
+        void* network_buffer,
+        const unsigned short network_buffer_length
+);
+int ws_server_wait(ws_server* server, ws_server_event* events, const int max_events, const int timeout_ms);
+int ws_server_watch_output(ws_server* server, const ws_handle* handle);
+int ws_broadcast_text(
+        ws_server* server,
+        ws_handle* const handles[],
+        const size_t num_handles,
+        const void* payload,
+        const size_t payload_length,
+        int results[]
+);
+void ws_server_close_connection(ws_server* server, ws_handle* handle);
+void ws_server_close(ws_server* server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //WEBSOCKET_C_WEBSOCKET_SERVER_H
@@ -0,0 +1,195 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ws_capture.h"
+
+#define _CAPTURE_MAGIC_LENGTH           4
+#define _CAPTURE_VERSION_OFFSET         4
+#define _CAPTURE_START_TIME_OFFSET      8
+#define _CAPTURE_DATA_LENGTH_OFFSET     16
+
+static uint64_t _now_ns(const clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void _store_data_length(ws_capture* capture) {
+    uint64_t data_length = capture->length - WS_CAPTURE_HEADER_LENGTH;
+    memcpy(capture->base + _CAPTURE_DATA_LENGTH_OFFSET, &data_length, sizeof(uint64_t));
+}
+
+// capacity is reserved up front (sparse), ws_capture_close truncates the file to what was used
+int ws_capture_create(ws_capture* capture, const char* path, const size_t capacity) {
+    if (capacity <= WS_CAPTURE_HEADER_LENGTH) {
+        return WS_ERROR_BUFFER_TOO_SHORT;
+    }
+
+    capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (capture->fd < 0) {
+        return WS_ERROR_CAPTURE_FILE;
+    }
+    if (ftruncate(capture->fd, (off_t) capacity) < 0) {
+        close(capture->fd);
+        return WS_ERROR_CAPTURE_FILE;
+    }
+
+    capture->base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (capture->base == MAP_FAILED) {
+        close(capture->fd);
+        return WS_ERROR_CAPTURE_FILE;
+    }
+
+    capture->capacity = capacity;
+    capture->length = WS_CAPTURE_HEADER_LENGTH;
+    capture->prepared_length = 0;
+    capture->is_writable = true;
+    capture->start_ns = _now_ns(CLOCK_MONOTONIC);
+
+    uint32_t version = WS_CAPTURE_VERSION;
+    uint64_t start_time = _now_ns(CLOCK_REALTIME);
+    memset(capture->base, 0, WS_CAPTURE_HEADER_LENGTH);
+    memcpy(capture->base, WS_CAPTURE_MAGIC, _CAPTURE_MAGIC_LENGTH);
+    memcpy(capture->base + _CAPTURE_VERSION_OFFSET, &version, sizeof(uint32_t));
+    memcpy(capture->base + _CAPTURE_START_TIME_OFFSET, &start_time, sizeof(uint64_t));
+    _store_data_length(capture);
+
+    return 0;
+}
+
+int ws_capture_open(ws_capture* capture, const char* path) {
+    struct stat st;
+
+    capture->fd = open(path, O_RDONLY);
+    if (capture->fd < 0) {
+        return WS_ERROR_CAPTURE_FILE;
+    }
+    if (fstat(capture->fd, &st) < 0) {
+        close(capture->fd);
+        return WS_ERROR_CAPTURE_FILE;
+    }
+    if (st.st_size < WS_CAPTURE_HEADER_LENGTH) {
+        close(capture->fd);
+        return WS_ERROR_CAPTURE_CORRUPT;
+    }
+
+    capture->capacity = (size_t) st.st_size;
+    capture->base = mmap(NULL, capture->capacity, PROT_READ, MAP_SHARED, capture->fd, 0);
+    if (capture->base == MAP_FAILED) {
+        close(capture->fd);
+        return WS_ERROR_CAPTURE_FILE;
+    }
+    capture->is_writable = false;
+
+    uint32_t version;
+    uint64_t data_length;
+    memcpy(&version, capture->base + _CAPTURE_VERSION_OFFSET, sizeof(uint32_t));
+    memcpy(&data_length, capture->base + _CAPTURE_DATA_LENGTH_OFFSET, sizeof(uint64_t));
+    if (memcmp(capture->base, WS_CAPTURE_MAGIC, _CAPTURE_MAGIC_LENGTH) != 0 ||
+        version != WS_CAPTURE_VERSION ||
+        data_length > capture->capacity - WS_CAPTURE_HEADER_LENGTH) {
+        ws_capture_close(capture);
+        return WS_ERROR_CAPTURE_CORRUPT;
+    }
+    capture->length = WS_CAPTURE_HEADER_LENGTH + (size_t) data_length;
+    capture->prepared_length = 0;
+
+    return 0;
+}
+
+int ws_capture_prepare(
+        ws_capture* capture,
+        const unsigned char direction,
+        const unsigned char opcode,
+        const void* payload,
+        const size_t payload_length
+) {
+    capture->prepared_length = 0;
+
+    size_t record_length = WS_CAPTURE_RECORD_HEADER_LENGTH + payload_length;
+    if (!capture->is_writable || payload_length > UINT32_MAX ||
+        record_length > capture->capacity - capture->length) {
+        return WS_ERROR_CAPTURE_FULL;
+    }
+
+    char* pos = capture->base + capture->length;
+    uint64_t timestamp_ns = _now_ns(CLOCK_MONOTONIC) - capture->start_ns;
+    uint32_t length = (uint32_t) payload_length;
+    memcpy(pos, &timestamp_ns, sizeof(uint64_t));
+    memcpy(pos + 8, &length, sizeof(uint32_t));
+    pos[12] = (char) direction;
+    pos[13] = (char) opcode;
+    pos[14] = 0;
+    pos[15] = 0;
+    memcpy(pos + WS_CAPTURE_RECORD_HEADER_LENGTH, payload, payload_length);
+
+    capture->prepared_length = record_length;
+    return 0;
+}
+
+void ws_capture_commit(ws_capture* capture) {
+    if (capture->prepared_length == 0) {
+        return;
+    }
+    capture->length += capture->prepared_length;
+    capture->prepared_length = 0;
+    _store_data_length(capture);
+}
+
+int ws_capture_append(
+        ws_capture* capture,
+        const unsigned char direction,
+        const unsigned char opcode,
+        const void* payload,
+        const size_t payload_length
+) {
+    int r = ws_capture_prepare(capture, direction, opcode, payload, payload_length);
+    if (r < 0) {
+        return r;
+    }
+    ws_capture_commit(capture);
+    return 0;
+}
+
+// offset starts at 0; returns 1 and advances offset while there are records, 0 at the end
+int ws_capture_next(const ws_capture* capture, size_t* offset, ws_capture_record* record) {
+    size_t data_length = capture->length - WS_CAPTURE_HEADER_LENGTH;
+    if (*offset == data_length) {
+        return 0;
+    }
+    if (*offset > data_length || data_length - *offset < WS_CAPTURE_RECORD_HEADER_LENGTH) {
+        return WS_ERROR_CAPTURE_CORRUPT;
+    }
+
+    const char* pos = capture->base + WS_CAPTURE_HEADER_LENGTH + *offset;
+    uint32_t length;
+    memcpy(&record->timestamp_ns, pos, sizeof(uint64_t));
+    memcpy(&length, pos + 8, sizeof(uint32_t));
+    record->direction = (unsigned char) pos[12];
+    record->opcode = (unsigned char) pos[13];
+
+    if (length > data_length - *offset - WS_CAPTURE_RECORD_HEADER_LENGTH) {
+        return WS_ERROR_CAPTURE_CORRUPT;
+    }
+    record->payload = pos + WS_CAPTURE_RECORD_HEADER_LENGTH;
+    record->payload_length = length;
+
+    *offset += WS_CAPTURE_RECORD_HEADER_LENGTH + length;
+    return 1;
+}
+
+int ws_capture_close(ws_capture* capture) {
+    int r = 0;
+    if (capture->is_writable && msync(capture->base, capture->length, MS_SYNC) < 0) {
+        r = WS_ERROR_CAPTURE_FILE;
+    }
+    munmap(capture->base, capture->capacity);
+    if (capture->is_writable && ftruncate(capture->fd, (off_t) capture->length) < 0) {
+        r = WS_ERROR_CAPTURE_FILE;
+    }
+    close(capture->fd);
+    return r;
+}
@@ -0,0 +1,75 @@
+#ifndef WEBSOCKET_C_WS_CAPTURE_H
+#define WEBSOCKET_C_WS_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "websocket_client.h"
+
+#define WS_CAPTURE_DIRECTION_OUTGOING                   0
+#define WS_CAPTURE_DIRECTION_INCOMING                   1
+
+// frame opcodes as recorded
+#define WS_CAPTURE_OPCODE_TEXT                          0x1
+#define WS_CAPTURE_OPCODE_BINARY                        0x2
+#define WS_CAPTURE_OPCODE_PING                          0x9
+#define WS_CAPTURE_OPCODE_PONG                          0xA
+
+// Capture file layout (host byte order):
+//   header: "WSCP" | uint32 version | uint64 start time (realtime ns) | uint64 data length | uint64 reserved
+//   record: uint64 time since start (ns) | uint32 payload length | uint8 direction | uint8 opcode | uint16 reserved
+//           followed by the unmasked payload
+#define WS_CAPTURE_MAGIC                                "WSCP"
+#define WS_CAPTURE_VERSION                              1
+#define WS_CAPTURE_HEADER_LENGTH                        32
+#define WS_CAPTURE_RECORD_HEADER_LENGTH                 16
+
+struct ws_capture {
+    int fd;
+    char* base;
+    size_t capacity;
+    size_t length;
+    size_t prepared_length; // record written past length, not part of the file until committed
+    uint64_t start_ns;
+    bool is_writable;
+};
+
+typedef struct {
+    uint64_t timestamp_ns;
+    unsigned char direction;
+    unsigned char opcode;
+    const char* payload;
+    size_t payload_length;
+} ws_capture_record;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ws_capture_create(ws_capture* capture, const char* path, const size_t capacity);
+int ws_capture_open(ws_capture* capture, const char* path);
+int ws_capture_append(
+        ws_capture* capture,
+        const unsigned char direction,
+        const unsigned char opcode,
+        const void* payload,
+        const size_t payload_length
+);
+// two step append for frames that may still fail: the record is written past the end and only
+// becomes part of the capture on commit, the next prepare or append overwrites an uncommitted one
+int ws_capture_prepare(
+        ws_capture* capture,
+        const unsigned char direction,
+        const unsigned char opcode,
+        const void* payload,
+        const size_t payload_length
+);
+void ws_capture_commit(ws_capture* capture);
+int ws_capture_next(const ws_capture* capture, size_t* offset, ws_capture_record* record);
+int ws_capture_close(ws_capture* capture);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //WEBSOCKET_C_WS_CAPTURE_H
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "../src/websocket_client.h"
+#include "../src/ws_capture.h"
+
+// ws_init takes the buffer length as unsigned short
+#define NETWORK_BUFFER_LENGTH 65535
+#define DEFAULT_NUM_CONNECTIONS 1
+#define DEFAULT_SPEED 1.0
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (deadline_ns / 1000000000ULL);
+    ts.tv_nsec = (long) (deadline_ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+// reads whatever the server sent so far so its socket buffers never fill up
+static int drain(ws_handle* ws) {
+    ws_received_message_type t;
+    void* payload;
+    struct timeval timeout;
+    int r;
+
+    do {
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+        r = ws_receive(ws, &t, &payload, &timeout);
+        if (r > 0 && t == WS_PAYLOAD_TYPE_PING) {
+            int r2 = ws_send_pong(ws, payload, (size_t) r);
+            if (r2 < 0) return r2;
+        }
+    } while (r >= 0 && t != WS_PAYLOAD_TYPE_NONE);
+
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    int r;
+
+    if (argc < 3 || argc > 5) {
+        printf("\n Usage: %s capture_file url [connections] [speed (0 = as fast as possible)]\n", argv[0]);
+        return 1;
+    }
+
+    size_t num_connections = argc > 3 ? (size_t) strtoul(argv[3], NULL, 10) : DEFAULT_NUM_CONNECTIONS;
+    double speed = argc > 4 ? strtod(argv[4], NULL) : DEFAULT_SPEED;
+    if (num_connections == 0 || speed < 0) {
+        printf("\nInvalid connections or speed\n");
+        return 1;
+    }
+
+    ws_capture capture;
+    r = ws_capture_open(&capture, argv[1]);
+    if (r < 0) {
+        printf("\nError in ws_capture_open: %d\n", r);
+        return 1;
+    }
+
+    ws_endpoint endpoint;
+    r = ws_parse_url(argv[2], &endpoint, false);
+    if (r < 0) {
+        printf("\nError in ws_url_parse: %d\n", r);
+        return 1;
+    }
+
+    ws_handle* connections = calloc(num_connections, sizeof(ws_handle));
+    char* buffers = malloc(num_connections * NETWORK_BUFFER_LENGTH);
+    if (connections == NULL || buffers == NULL) {
+        printf("\nOut of memory\n");
+        return 1;
+    }
+
+    size_t i;
+    for (i = 0; i < num_connections; ++i) {
+        r = ws_init(&connections[i], buffers + i * NETWORK_BUFFER_LENGTH, NETWORK_BUFFER_LENGTH, endpoint, NULL, 0);
+        if (r < 0) {
+            printf("\nError in ws_init for connection %d: %d\n", (int) i, r);
+            return 1;
+        }
+    }
+
+    size_t offset = 0;
+    size_t num_frames = 0;
+    size_t num_skipped = 0;
+    size_t num_sends_skipped = 0;
+    uint64_t num_bytes = 0;
+    uint64_t first_timestamp_ns = 0;
+    ws_capture_record record;
+    uint64_t start_ns = now_ns();
+
+    while ((r = ws_capture_next(&capture, &offset, &record)) > 0) {
+        if (record.direction != WS_CAPTURE_DIRECTION_OUTGOING) {
+            continue;
+        }
+        // pongs are answers to the server and only text frames can be sent through the client api
+        if (record.opcode != WS_CAPTURE_OPCODE_TEXT) {
+            num_skipped++;
+            continue;
+        }
+
+        // timestamps count from when the capture was created, the idle time before the first
+        // replayed frame is not replayed
+        if (num_frames == 0) {
+            first_timestamp_ns = record.timestamp_ns;
+        }
+        if (speed > 0) {
+            sleep_until_ns(start_ns + (uint64_t) ((double) (record.timestamp_ns - first_timestamp_ns) / speed));
+        }
+
+        for (i = 0; i < num_connections; ++i) {
+            // the outgoing payload goes behind received bytes ws_receive hasn't returned yet,
+            // a partial frame from the server leaves less room until the rest of it arrives
+            if (record.payload_length > ws_get_outgoing_payload_capacity(&connections[i])) {
+                r = drain(&connections[i]);
+                if (r < 0) {
+                    printf("\nError in ws_receive for connection %d: %d\n", (int) i, r);
+                    return 1;
+                }
+                if (record.payload_length > ws_get_outgoing_payload_capacity(&connections[i])) {
+                    num_sends_skipped++;
+                    continue;
+                }
+            }
+            memcpy(ws_get_outgoing_payload_ptr(&connections[i]), record.payload, record.payload_length);
+            r = ws_send_text(&connections[i], record.payload_length);
+            if (r < 0) {
+                printf("\nError in ws_send_text for connection %d: %d\n", (int) i, r);
+                return 1;
+            }
+            r = drain(&connections[i]);
+            if (r < 0) {
+                printf("\nError in ws_receive for connection %d: %d\n", (int) i, r);
+                return 1;
+            }
+        }
+
+        num_frames++;
+        num_bytes += record.payload_length;
+    }
+
+    if (r < 0) {
+        printf("\nError in ws_capture_next: %d\n", r);
+        return 1;
+    }
+
+    double elapsed_s = (double) (now_ns() - start_ns) / 1e9;
+    printf("\nreplayed %d frames (%llu payload bytes) on %d connections in %.3fs, %.0f frames/s, skipped %d, "
+           "%d sends did not fit\n", (int) num_frames, (unsigned long long) num_bytes, (int) num_connections,
+           elapsed_s, elapsed_s > 0 ? (double) (num_frames * num_connections - num_sends_skipped) / elapsed_s : 0.0,
+           (int) num_skipped, (int) num_sends_skipped);
+
+    ws_capture_close(&capture);
+    return 0;
+}